@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include "sharded_counter.h"
+
+/* Benchmark: which counter should a hot metric use?
+ * Every thread does INCREMENTS increments on the same logical counter, for 1, 2, 4, 8, 16 threads
+ */
+#define INCREMENTS 2000000
+
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static long g_mutex_counter;
+static atomic_long g_atomic_counter;
+static sharded_counter_t g_sharded_counter;
+
+static void *mutex_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < INCREMENTS; i++)
+    {
+        pthread_mutex_lock(&g_lock);
+        g_mutex_counter++;
+        pthread_mutex_unlock(&g_lock);
+    }
+    return NULL;
+}
+
+static void *atomic_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < INCREMENTS; i++)
+        atomic_fetch_add_explicit(&g_atomic_counter, 1, memory_order_relaxed);
+    return NULL;
+}
+
+static void *sharded_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < INCREMENTS; i++)
+        sharded_counter_add(&g_sharded_counter, 1);
+    return NULL;
+}
+
+double get_time_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+/* Run fn on n threads, return million increments per second */
+static double run(void *(*fn)(void *), int n)
+{
+    pthread_t threads[64];
+    double start = get_time_sec();
+
+    for (int i = 0; i < n; i++)
+        pthread_create(&threads[i], NULL, fn, NULL);
+    for (int i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+
+    return (double)n * INCREMENTS / (get_time_sec() - start) / 1e6;
+}
+
+int main()
+{
+    printf("Counter benchmark: %d increments per thread (M increments/sec)\n", INCREMENTS);
+    printf("%8s %12s %12s %12s\n", "threads", "mutex", "atomic", "sharded");
+
+    for (int n = 1; n <= 16; n *= 2)
+    {
+        g_mutex_counter = 0;
+        atomic_store(&g_atomic_counter, 0);
+        sharded_counter_init(&g_sharded_counter, n);
+
+        double m = run(mutex_worker, n);
+        double a = run(atomic_worker, n);
+        double s = run(sharded_worker, n);
+
+        long expect = (long)n * INCREMENTS;
+        if (g_mutex_counter != expect || atomic_load(&g_atomic_counter) != expect ||
+            sharded_counter_read_exact(&g_sharded_counter) != expect)
+        {
+            printf("[Result] Counter mismatch at %d threads!\n", n);
+            return 1;
+        }
+
+        printf("%8d %12.2f %12.2f %12.2f\n", n, m, a, s);
+        sharded_counter_destroy(&g_sharded_counter);
+    }
+
+    return 0;
+}
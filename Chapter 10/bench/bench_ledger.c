@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "thread_pool.h"
+#include "flat_combining.h"
+
+/* Benchmark: Chapter 5 bank deposit on ONE ledger (cannot be sharded)
+ * mutex: pthread_mutex_lock around every deposit
+ * flat combining: publish the deposit, one combiner applies the whole batch
+ */
+#define TASKS 10000
+#define DEPOSITS_PER_TASK 100
+
+typedef struct
+{
+    long balance;
+    long operations;
+} ledger_t;
+
+static ledger_t g_ledger;
+static pthread_mutex_t g_ledger_lock = PTHREAD_MUTEX_INITIALIZER;
+static flat_combiner_t g_combiner;
+
+static void deposit(void *state, void *arg)
+{
+    ledger_t *ledger = (ledger_t *)state;
+    ledger->balance += (long)arg;
+    ledger->operations++;
+}
+
+static void deposit_task_mutex(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < DEPOSITS_PER_TASK; i++)
+    {
+        pthread_mutex_lock(&g_ledger_lock);
+        deposit(&g_ledger, (void *)1L);
+        pthread_mutex_unlock(&g_ledger_lock);
+    }
+}
+
+static void deposit_task_fc(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < DEPOSITS_PER_TASK; i++)
+        flat_combiner_execute(&g_combiner, deposit, (void *)1L);
+}
+
+double get_time_sec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static double run(int threads, void (*task)(void *))
+{
+    g_ledger.balance = 0;
+    g_ledger.operations = 0;
+
+    thread_pool_t *pool = thread_pool_create(threads, 1024);
+    if (!pool)
+        exit(1);
+
+    double start = get_time_sec();
+    for (int i = 0; i < TASKS; i++)
+    {
+        while (thread_pool_add(pool, task, NULL) != 0)
+        {
+        }
+    }
+    while (thread_pool_completed(pool) < TASKS)
+        usleep(100);
+    double duration = get_time_sec() - start;
+
+    thread_pool_destroy(pool);
+
+    if (g_ledger.balance != (long)TASKS * DEPOSITS_PER_TASK)
+    {
+        printf("[Result] Wrong balance %ld!\n", g_ledger.balance);
+        exit(1);
+    }
+
+    return (double)TASKS * DEPOSITS_PER_TASK / duration / 1e6;
+}
+
+int main()
+{
+    printf("Ledger benchmark: %d deposits (M deposits/sec)\n", TASKS * DEPOSITS_PER_TASK);
+    printf("%8s %12s %16s\n", "workers", "mutex", "flat combining");
+
+    flat_combiner_init(&g_combiner, &g_ledger);
+
+    for (int n = 1; n <= 16; n *= 2)
+    {
+        double m = run(n, deposit_task_mutex);
+        double f = run(n, deposit_task_fc);
+        printf("%8d %12.2f %16.2f\n", n, m, f);
+    }
+
+    flat_combiner_destroy(&g_combiner);
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef ARG_SLAB_H
+#define ARG_SLAB_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*  Size-class slabs for task arguments
+    Producer mallocs args, worker frees them: that is cross-thread malloc/free,
+    glibc arenas then fight over locks. Here every thread owns its blocks,
+    and a block freed by another thread goes back through a lock-free "remote free" list.
+*/
+#define ARG_SLAB_CLASSES 8          // 16, 32, 64, ... 2048 bytes
+#define ARG_SLAB_MAX_SIZE 2048      // Bigger args fall back to malloc
+#define ARG_SLAB_CHUNK (64 * 1024)  // Carve blocks from 64 KB chunks
+
+typedef struct arg_block
+{
+    struct arg_block *next; // Only valid while the block is free
+} arg_block_t;
+
+struct arg_slab;
+
+/* One cache per (thread, pool). The owner is the thread whose TLS (slab->key) holds the cache:
+ * pthread_t values are reused, a cache pointer is not
+ */
+typedef struct arg_cache
+{
+    /* Owner-only fields (no atomics needed) */
+    struct arg_slab *slab;
+    arg_block_t *free_list[ARG_SLAB_CLASSES];
+    char *bump;     // Next free byte of current chunk
+    char *bump_end; // End of current chunk
+    void *chunks;   // All chunks (linked through their first word), freed at destroy
+    struct arg_cache *next_cache;
+    struct arg_cache *next_orphan; // In slab->orphans after its thread exited (protected by orphan_lock)
+
+    /* Written by other threads: keep on its own cache line (no false sharing with owner) */
+    _Alignas(64) _Atomic(arg_block_t *) remote_free[ARG_SLAB_CLASSES];
+} arg_cache_t;
+
+typedef struct arg_slab
+{
+    pthread_key_t key;            // Thread -> arg_cache_t of this slab
+    _Atomic(arg_cache_t *) caches; // Every cache ever created (freed at destroy)
+
+    /* Caches of exited threads (key destructor), adopted by the next new thread with its blocks.
+     * Rare path (thread start / exit): a mutex is enough
+     */
+    pthread_mutex_t orphan_lock;
+    arg_cache_t *orphans;
+} arg_slab_t;
+
+int arg_slab_init(arg_slab_t *slab);
+void arg_slab_destroy(arg_slab_t *slab);
+void *arg_slab_alloc(arg_slab_t *slab, size_t size);
+void arg_slab_free(void *ptr);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef CGROUP_CPU_H
+#define CGROUP_CPU_H
+
+/*  CPU limit of this process as seen by the cgroup (v1 or v2)
+    In Kubernetes, cpu.max "200000 100000" means 2 CPUs of quota even on a 64-core node
+*/
+typedef struct
+{
+    double quota_cpus; // quota / period (0: no quota)
+    int cpuset_cpus;   // CPUs in cpuset AND in sched_getaffinity
+    int effective;     // Workers we should run: min(ceil(quota), cpuset), at least 1
+    int version;       // Where the quota came from: 1, 2 or 0 (no quota found)
+} cgroup_cpu_limit_t;
+
+/* Read cpu.max (v2) or cpu.cfs_quota_us / cpu.cfs_period_us (v1) and the cpuset.
+ * Return 0 on success, -1 when neither the quota nor the cpuset could be read
+ */
+int cgroup_cpu_limit_read(cgroup_cpu_limit_t *limit);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+/*  Placement policy: how worker i is mapped onto the CPUs we are allowed to run on
+    (The allowed CPUs come from sched_getaffinity, not from _SC_NPROCESSORS_ONLN)
+*/
+typedef enum
+{
+    THREAD_POOL_PLACE_NONE = 0, // No pinning, workers float inside the allowed mask
+    THREAD_POOL_PLACE_COMPACT,  // Fill cores one by one, SMT siblings next to each other
+    THREAD_POOL_PLACE_SCATTER,  // One worker per physical core first, SMT siblings last
+    THREAD_POOL_PLACE_L3,       // One worker per L3 cache domain, then wrap around
+} thread_pool_placement_t;
+
+/* One allowed logical CPU, read from /sys/devices/system/cpu/cpuN */
+typedef struct
+{
+    int cpu;      // Logical CPU number (what CPU_SET takes)
+    int package;  // topology/physical_package_id
+    int core;     // topology/core_id (unique inside a package)
+    int smt_rank; // 0: first hardware thread of the core, 1: its sibling, ...
+    int l3;       // L3 domain (first CPU of L3 shared_cpu_list), -1 if unknown
+} cpu_info_t;
+
+typedef struct
+{
+    int count;       // Number of CPUs in the allowed mask
+    cpu_info_t *cpus; // Sorted by logical CPU number
+} cpu_topology_t;
+
+/* Load the allowed CPUs of this process and their topology. Return 0 on success */
+int cpu_topology_load(cpu_topology_t *topo);
+void cpu_topology_free(cpu_topology_t *topo);
+
+/* Fill out_cpus[0..n-1] with the CPU of every worker (-1: not pinned) */
+int cpu_topology_place(const cpu_topology_t *topo, thread_pool_placement_t policy,
+                       int n, int *out_cpus);
+
+/* Count CPUs of a sysfs/cgroup CPU list file (Ex: "0-3,8") that we are also allowed to run on */
+int cpu_topology_count_list(const char *path);
+
+const char *cpu_placement_name(thread_pool_placement_t policy);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef FLAT_COMBINING_H
+#define FLAT_COMBINING_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*  Flat combining: for state that cannot be sharded (one ledger, one index)
+    1. Every thread publishes its operation in its own slot
+    2. Whoever gets the combiner lock applies ALL pending operations
+    So the state (and the lock) stay in one core's cache, instead of moving on every operation
+*/
+#define FC_MAX_THREADS 128
+
+typedef void (*fc_op_t)(void *state, void *arg);
+
+typedef struct
+{
+    _Alignas(64) atomic_int pending; // 1: published, waiting for a combiner
+    atomic_int owned;                // 1: held by a thread, 0: free (never used, or its thread exited)
+    fc_op_t op;
+    void *arg;
+} fc_slot_t;
+
+typedef struct
+{
+    _Alignas(64) atomic_int lock; // Combiner role (0: free)
+    void *state;                  // Only touched by the combiner
+    atomic_int used;              // Slots ever handed out (high water, at most FC_MAX_THREADS)
+    pthread_key_t key;            // Thread -> its fc_slot_t
+    fc_slot_t slots[FC_MAX_THREADS];
+} flat_combiner_t;
+
+int flat_combiner_init(flat_combiner_t *fc, void *state);
+void flat_combiner_destroy(flat_combiner_t *fc);
+
+/* Apply op(state, arg) exclusively, return when it is done (by us or by another combiner) */
+void flat_combiner_execute(flat_combiner_t *fc, fc_op_t op, void *arg);
+
+#endif
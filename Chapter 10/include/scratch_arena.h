@@ -0,0 +1,34 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <stddef.h>
+
+/*  Per-worker bump allocator for temporary buffers inside a task
+    alloc = move a pointer, free = nothing, the worker resets the whole arena after each task
+*/
+#define SCRATCH_DEFAULT_CHUNK (1024 * 1024) // Grow in 1 MB chunks (mmap)
+
+typedef struct scratch_chunk
+{
+    struct scratch_chunk *next;
+    size_t size; // Usable bytes after the header
+    size_t used;
+} scratch_chunk_t;
+
+typedef struct
+{
+    scratch_chunk_t *head;    // First chunk, chunks are kept and reused after reset
+    scratch_chunk_t *current; // Chunk we are allocating from
+    size_t chunk_size;        // Minimum size of a new chunk
+    size_t used;              // Bytes handed out since the last reset
+    size_t high_water;        // Largest "used" ever seen by one task
+    size_t reserved;          // Bytes mapped right now
+} scratch_arena_t;
+
+void scratch_arena_init(scratch_arena_t *arena, size_t chunk_size);
+void *scratch_arena_alloc(scratch_arena_t *arena, size_t size);
+void scratch_arena_reset(scratch_arena_t *arena);
+void scratch_arena_trim(scratch_arena_t *arena); // Give every chunk back to the OS
+void scratch_arena_destroy(scratch_arena_t *arena);
+
+#endif
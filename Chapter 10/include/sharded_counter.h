@@ -0,0 +1,44 @@
+#ifndef SHARDED_COUNTER_H
+#define SHARDED_COUNTER_H
+
+#include <stdatomic.h>
+
+/*  Sharded counter: one padded slot per worker/thread
+    - add: relaxed atomic on our own cache line (no bouncing between cores)
+    - read: sum of all slots (approximate while writers run, exact once they are quiet)
+*/
+typedef struct
+{
+    _Alignas(64) atomic_long value; // 64 bytes per slot: no false sharing
+} sharded_counter_slot_t;
+
+typedef struct
+{
+    int mask;                     // shards - 1 (shards is a power of 2)
+    sharded_counter_slot_t *slots;
+} sharded_counter_t;
+
+int sharded_counter_init(sharded_counter_t *counter, int shards);
+void sharded_counter_destroy(sharded_counter_t *counter);
+
+/* Slot of the calling thread (assigned round robin on first use) */
+extern __thread int sharded_counter_tls_id;
+int sharded_counter_assign_id(void);
+
+static inline void sharded_counter_add_at(sharded_counter_t *counter, int shard, long delta)
+{
+    atomic_fetch_add_explicit(&(counter->slots[shard & counter->mask].value), delta, memory_order_relaxed);
+}
+
+static inline void sharded_counter_add(sharded_counter_t *counter, long delta)
+{
+    int id = sharded_counter_tls_id;
+    if (id == 0)
+        id = sharded_counter_assign_id();
+    sharded_counter_add_at(counter, id - 1, delta);
+}
+
+long sharded_counter_read(const sharded_counter_t *counter);       // Approximate, relaxed loads
+long sharded_counter_read_exact(const sharded_counter_t *counter); // Exact when no add is running
+
+#endif
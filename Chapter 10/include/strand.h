@@ -0,0 +1,64 @@
+#ifndef STRAND_H
+#define STRAND_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*  Strand: tasks with the same key run in submission order and never at the same time
+    Tasks with different keys run in parallel (no global lock like g_balance_lock)
+    Each strand is a lock-free MPSC queue. While it has work, it sits in the pool as ONE task
+    Every key has its own strand: created by the first task of the key, freed when its last task is done.
+    The table only holds the keys with work, any number of keys over time
+*/
+struct thread_pool;
+
+typedef struct strand_node
+{
+    _Atomic(struct strand_node *) next;
+    void (*function)(void *);
+    void *argument;
+} strand_node_t;
+
+typedef struct strand
+{
+    struct thread_pool *pool;
+    unsigned long key;
+    struct strand *next;                        // Bucket chain (bucket lock)
+    struct strand *deferred_next;               // Waiting for a ring slot (pool->lock)
+    _Alignas(64) _Atomic(strand_node_t *) tail; // Producers: atomic_exchange
+    _Alignas(64) strand_node_t *head;           // Consumer only (the worker running the strand)
+    strand_node_t stub;                         // Queue is never empty (Vyukov MPSC)
+    atomic_long pending;                        // Tasks queued, 0 -> 1 schedules the strand, 1 -> 0 frees it
+} strand_t;
+
+typedef struct
+{
+    pthread_mutex_t lock; // Chain, and the pending transitions 0 -> 1 / 1 -> 0 of its strands
+    strand_t *chain;
+} strand_bucket_t;
+
+/* key -> strand: hash(key) & mask selects a bucket, the bucket chains the live strands of its keys */
+typedef struct
+{
+    unsigned long mask; // buckets - 1 (power of 2)
+    strand_bucket_t *buckets;
+} strand_table_t;
+
+#define STRAND_DEFAULT_CAPACITY 1024
+#define STRAND_BATCH 32 // Tasks run before the strand goes back to the end of the queue
+
+int strand_table_init(strand_table_t *table, int capacity);
+void strand_table_destroy(strand_table_t *table);
+
+/* Queue node on the strand of key (created if the key has none). *schedule = 1: the strand was idle,
+ * the caller must put it into the pool. NULL only if out of memory
+ */
+strand_t *strand_submit(strand_table_t *table, struct thread_pool *pool, unsigned long key, strand_node_t *node,
+                        int *schedule);
+
+/* The runner finished one task. 1: that was the last one, the strand is freed (do not touch it anymore) */
+int strand_task_done(strand_table_t *table, strand_t *strand);
+
+strand_node_t *strand_pop(strand_t *strand);
+
+#endif
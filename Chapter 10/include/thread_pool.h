@@ -2,38 +2,441 @@
 #define THREAD_POOL_H
 
 #include <pthread.h>
+#include <stddef.h>
+#include <stdio.h> // FILE (thread_pool_func_report)
 #include <stdatomic.h> // <--- Chapter 10. Add library of C11 Atomic
+#include "cpu_topology.h"
+#include "cgroup_cpu.h"
+#include "arg_slab.h"
+#include "scratch_arena.h"
+#include "sharded_counter.h"
+#include "strand.h"
+#include "tp_clock.h"
+#include "tp_histogram.h"
+#include "tp_trace.h"
+#include "tp_perf.h"
+#include "tp_sampler.h"
+
+#define THREAD_TASK_INLINE 0x1   // Argument lives in inline_arg, not behind argument
+#define THREAD_TASK_INTERNAL 0x2 // Pool machinery (strand runner, group wrapper): never dropped by DROP_OLDEST
+
+/* Enqueue timestamp in the task: queue-wait / run-time histograms and class wait stats
+   (make TIMESTAMPS=0 compiles it out of thread_pool_add and thread_pool_worker) */
+#ifndef THREAD_POOL_TIMESTAMPS
+#define THREAD_POOL_TIMESTAMPS 1
+#endif
+
+/* Bytes of argument that can be copied into the ring slot itself (make INLINE_ARG_SIZE=...)
+   The default keeps thread_task_t at 64 bytes = 1 cache line:
+   8 (function) + 40 + 4 (flags) + 4 (padding) + 8 (enqueue_ts) with TIMESTAMPS=1,
+   8 (function) + 48 + 4 (flags) + 4 (padding) without */
+#if THREAD_POOL_TIMESTAMPS
+#define THREAD_POOL_INLINE_ARG_DEFAULT 40
+#else
+#define THREAD_POOL_INLINE_ARG_DEFAULT 48
+#endif
+#ifndef THREAD_POOL_INLINE_ARG_SIZE
+#define THREAD_POOL_INLINE_ARG_SIZE THREAD_POOL_INLINE_ARG_DEFAULT
+#endif
+
+/* Contention profile of pool->lock per call site (make LOCKPROF=1, off by default: 3 clock reads per lock) */
+#ifndef THREAD_POOL_LOCKPROF
+#define THREAD_POOL_LOCKPROF 0
+#endif
 
 typedef struct
 {
     void (*function)(void *);
-    void *argument;
+    union
+    {
+        void *argument;                                   // thread_pool_add: pointer to caller's data
+        unsigned char inline_arg[THREAD_POOL_INLINE_ARG_SIZE]; // thread_pool_add_inline: copy of the data
+    };
+    unsigned int flags; // THREAD_TASK_*
+#if THREAD_POOL_TIMESTAMPS
+    uint64_t enqueue_ts; // tp_clock_ticks() at submit
+#endif
 } thread_task_t;
 
+/* make INLINE_ARG_SIZE=... is a deliberate trade, the default must stay on one line */
+_Static_assert(THREAD_POOL_INLINE_ARG_SIZE != THREAD_POOL_INLINE_ARG_DEFAULT || sizeof(thread_task_t) == 64,
+               "thread_task_t must fill exactly one cache line");
+
+/*  Submission class (tenant): own ring, own weight
+    Workers pick classes by Deficit Round Robin: every round a class earns weight x quantum
+    of worker time, and pays the run time of its tasks
+*/
+#define THREAD_POOL_MAX_CLASSES 16
+#define THREAD_POOL_DRR_QUANTUM_NS 100000 // 100 us of worker time per weight unit and round
+
+typedef struct
+{
+    char name[32];
+    int weight;
+    thread_task_t *queue; // Ring Buffer of this class
+    int queue_size;
+    int head;
+    int tail;
+    int count;
+    /* Protected by pool->lock */
+    long deficit;       // DRR credit (ns), a class is served while > 0
+    int running;        // Tasks of this class executing now
+    long completed;     // Tasks finished
+    long timed;         // Stamped tasks finished (wait_ns_* are over these)
+    long wait_ns_total; // Queue wait (TIMESTAMPS=1)
+    long wait_ns_max;
+    int min_workers; // Bulkhead: workers reserved for this class (lent out while it has no work)
+    int max_workers; // Bulkhead: never more workers than this at once (0: no cap)
+} thread_pool_class_t;
+
+typedef struct
+{
+    const char *name;
+    int weight;
+    int queued;
+    int running;
+    long completed;
+    int min_workers;
+    int max_workers;
+    double wait_avg_ns;
+    long wait_max_ns;
+} thread_pool_class_stats_t;
+
+/* What thread_pool_add does when the ring is full */
+typedef enum
+{
+    THREAD_POOL_OVERFLOW_REJECT = 0,  // Return -2 (Chapter 2 behavior)
+    THREAD_POOL_OVERFLOW_CALLER_RUNS, // Run the task on the submitting thread (throttles the producer)
+    THREAD_POOL_OVERFLOW_BLOCK,       // Sleep until a worker frees a slot
+    THREAD_POOL_OVERFLOW_DROP_OLDEST, // Drop the oldest user task, pass it to the discard callback
+} thread_pool_overflow_t;
+
+typedef struct
+{
+    long rejected;    // REJECT: -2 returned
+    long caller_runs; // CALLER_RUNS: tasks run by the producer
+    long blocked;     // BLOCK: times a producer had to sleep
+    long dropped;     // DROP_OLDEST: tasks dropped
+} thread_pool_overflow_stats_t;
+
+/*  Attributes of a pool: everything thread_pool_create(thread_count, queue_size) cannot express
+    Always start from thread_pool_attr_init(), then change the fields you need
+*/
+typedef struct
+{
+    int thread_count;                  // Numbers of threads
+    int queue_size;                    // Size of Queue
+    size_t stack_size;                 // Worker stack (default 256 KB, not the 8 MB of glibc)
+    thread_pool_placement_t placement; // Worker placement policy
+    const char *name;                  // Thread name prefix, worker i is "<name>-<i>" (NULL: no name)
+    int lazy_start;                    // 1: start a worker only when a task finds no idle worker
+    size_t scratch_chunk_size;         // Growth step of the per-worker scratch arena
+    int scratch_idle_ms;               // Idle this long => scratch memory back to the OS (0: never)
+    size_t worker_local_size;          // Bytes of thread_pool_worker_local per worker (0: none)
+    int strand_capacity;               // Buckets of the key -> strand table of thread_pool_add_keyed (not a limit)
+    thread_pool_overflow_t overflow_policy;                         // Full ring behavior
+    void (*overflow_discard)(void (*function)(void *), void *argument); // DROP_OLDEST: free the dropped arg
+    int max_spares;                    // Extra workers while tasks are inside begin/end_blocking (0: none)
+    unsigned long trace_capacity;      // Trace events kept per worker for thread_pool_trace_dump (0: off)
+    int perf_counters;                 // 1: perf_event_open counters per worker and per task function (0: off)
+    int profile_functions;             // 1: run time and thread CPU time per task function (0: off)
+    int sample_hz;                     // Stack samples per second of worker CPU time (0: sampler off)
+    unsigned long sample_capacity;     // Samples kept per worker (most recent)
+    const char *monitor_path;          // Unix socket of the metrics endpoint, also dumps on SIGUSR1 (NULL: off)
+    int watchdog_budget_ms;            // Report tasks running longer than this (0: watchdog off)
+    int watchdog_stacks;               // 1: the report includes a stack sample of the slow worker
+} thread_pool_attr_t;
+
+struct thread_pool;
+
+/* Per-worker runtime counters: written only by their worker (relaxed, on their own cache line), read lock-free */
+typedef struct
+{
+    _Alignas(64) atomic_long tasks; // Tasks executed (including the ones run while helping)
+    atomic_long start_ns;           // tp_clock_ns() when the worker started, 0: slot never started
+    atomic_long idle_ns;            // Sum of finished idle periods (waiting for a task, or parked spare)
+    atomic_long idle_since;         // Start of the current idle period, 0: busy
+    atomic_long parks;              // Times it went to sleep
+    atomic_long wakeups;            // Times it woke up (task, broadcast, timeout, spurious)
+    atomic_long helped;             // Tasks taken from the ring while waiting inside a task
+    _Atomic(void *) current_task;   // Function of the task running now, NULL: none
+    atomic_ulong current_start;     // tp_clock_ticks() when it started (0: not measured, TIMESTAMPS=0)
+    atomic_int parked;              // Spare parked until thread_pool_begin_blocking needs it
+} thread_pool_worker_counters_t;
+
+/*  Per-function totals of one worker: open addressing on the function pointer
+    Written only by the worker (function is published last, release), read lock-free.
+    A worker running more than THREAD_POOL_FUNC_SLOTS distinct functions does not attribute the extra ones
+*/
+#define THREAD_POOL_FUNC_SLOTS 64 // Power of 2
+
+typedef struct
+{
+    _Atomic(void *) function; // NULL: free slot
+    atomic_long count;
+    atomic_long run_ns;     // Wall time, summed
+    atomic_long run_ns_max;
+    atomic_long cpu_ns;     // CLOCK_THREAD_CPUTIME_ID, summed (attr.profile_functions)
+    atomic_long perf[TP_PERF_EVENTS]; // Counter deltas summed over the runs (attr.perf_counters)
+} thread_pool_func_slot_t;
+
+/* Per-worker state, worker i runs with &pool->workers[i] as argument */
+typedef struct
+{
+    struct thread_pool *pool;
+    pthread_t thread;
+    int id;  // Index in pool->workers
+    int cpu; // Pinned CPU (-1: not pinned)
+    scratch_arena_t scratch; // thread_pool_scratch_alloc, reset after every task
+    void *local;             // thread_pool_worker_local (cache-line aligned, zeroed)
+    unsigned long bcast_seen; // Last broadcast this worker executed (protected by pool->lock)
+    int charge_class;         // Class of the last task, -1: nothing to charge
+    long charge_ns;           // Its run time, charged to the class at the next lock
+    long charge_wait_ns;      // Its queue wait, -1: not measured (TIMESTAMPS=0)
+    int spare;                // 1: compensation worker (index >= thread_count), parks when not needed
+    int blocking;             // Nesting depth of thread_pool_begin_blocking
+    int cpu_counted;          // The current task counts in pool->running (the quota was binding when it started)
+    int tid;                  // Kernel thread id (watchdog stack sample), set before the slot is published
+    thread_pool_worker_counters_t stats; // thread_pool_get_stats
+    tp_perf_t perf;                      // Counters of this thread (attr.perf_counters)
+    thread_pool_func_slot_t *funcs;      // THREAD_POOL_FUNC_SLOTS entries, NULL: not attributed
+    tp_sampler_t sampler;                // CPU-time stack samples (attr.sample_hz)
+#if THREAD_POOL_TIMESTAMPS
+    tp_histogram_t *hist;  // [0]: submit -> start of the tasks this worker ran, [1]: start -> end
+                           // ~9 KB each: allocated when the slot starts (NULL: never started, or out of memory)
+    tp_trace_ring_t trace;    // Task timeline (attr.trace_capacity > 0)
+#endif
+} thread_pool_worker_t;
+
+/* Snapshot of one worker (thread_pool_get_stats) */
+typedef struct
+{
+    int id;         // Index in pool->workers
+    int spare;      // 1: compensation worker (see thread_pool_begin_blocking)
+    long tasks;
+    long busy_ns;   // Alive and not idle (running tasks, or taking them)
+    long idle_ns;
+    long parks;
+    long wakeups;
+    long helped;    // No work stealing / batch dequeue here: tasks run while helping a wait
+    uint64_t perf[TP_PERF_EVENTS]; // Whole thread since start (attr.perf_counters), see stats->perf_names
+} thread_pool_worker_stats_t;
+
+typedef struct
+{
+    thread_pool_worker_stats_t *workers; // Filled by the caller: array of workers_capacity entries
+    int workers_capacity;
+    int worker_count;     // Entries written
+    int queue_depth;      // Tasks queued now (all classes)
+    int queue_high_water; // Largest queue depth seen
+    long rejected;        // Submissions rejected by a full ring (REJECT policy)
+    long completed;
+    const char *perf_names[TP_PERF_EVENTS]; // Event of each perf slot, NULL: not counted
+} thread_pool_stats_t;
+
+/* One task function, summed over all workers (thread_pool_get_func_stats) */
+typedef struct
+{
+    void (*function)(void *);
+    long count;
+    long run_ns_total;
+    long run_ns_max;
+    long cpu_ns_total; // Time on CPU: below run_ns_total when the task blocks or is preempted
+    uint64_t perf[TP_PERF_EVENTS];
+} thread_pool_func_stats_t;
+
+/* Where pool->lock is taken (LOCKPROF). Control paths (class create, stats, ...) are not profiled */
+typedef enum
+{
+    THREAD_POOL_LOCK_ADD,     // Producer: thread_pool_add and friends
+    THREAD_POOL_LOCK_DEQUEUE, // Worker: take a task, charge the previous one
+    THREAD_POOL_LOCK_HELP,    // Waiting thread: run a queued task or sleep in thread_pool_wait
+    THREAD_POOL_LOCK_DESTROY,
+    THREAD_POOL_LOCK_BROADCAST, // thread_pool_broadcast: publish, run its own part, wait for the workers
+    THREAD_POOL_LOCK_SITES
+} thread_pool_lock_site_t;
+
+/* Written under pool->lock (one writer at a time), read without it */
+typedef struct
+{
+    atomic_long acquired;
+    atomic_long contended; // try-lock failed: the thread had to wait
+    tp_histogram_t wait;   // Lock wait of the contended acquisitions
+    tp_histogram_t hold;   // Lock held, until unlock or a condvar wait
+} thread_pool_lock_prof_t;
+
+typedef struct
+{
+    const char *site;
+    long acquired;
+    long contended;
+} thread_pool_lock_stats_t;
+
 /*  2. Define thread pool structure
     With Sync (Lock/Cond), Ring Buffer(Task Queue) and array of threads
 */
-typedef struct
+typedef struct thread_pool
 {
-    pthread_mutex_t lock;  // Mutex Lock of Queue
-    pthread_cond_t notify; // Conditional Variable of worker thread
-    pthread_t *threads;    // Array of thread ID (Dynamic allocate)
-    thread_task_t *queue;  // Task Queue
+    pthread_mutex_t lock;          // Mutex Lock of Queue
+    pthread_cond_t notify;         // Conditional Variable of worker thread
+    thread_pool_worker_t *workers; // Array of workers (Dynamic allocate)
     int thread_count;      // Numbers of threads
-    int queue_size;        // Size of Queue
-    int head;              // Ring Buffer Head (taking next task)
-    int tail;              // Ring Buffer Tail (adding a task)
-    int count;             // Number of threads
+    int started;           // Workers really created (< thread_count with lazy_start)
+    int lazy_starting;     // Protected by lock, a producer creates workers[started] outside the lock (one at a time)
+    int idle;              // Workers sleeping in pthread_cond_wait
+    int queue_size;        // Size of Queue (default class)
+    int count;             // Tasks queued in all classes
     int shutdown;          // Flag (0: operate, 1: shutdown)
 
     /* TODO: Chapter 10. Add atomic counter */
-    /* _Atomic is keyword in C11, ensure the variable doing ++ -- is atomic exectued */
-    atomic_int task_completed;
+    /* One atomic_int is bounced between all cores on every task: one padded slot per worker instead */
+    /* Read with thread_pool_completed(pool) */
+    sharded_counter_t task_completed;
+
+    /* Worker placement (from sched_getaffinity + sysfs topology) */
+    thread_pool_placement_t placement; // Policy used at create
+    int *worker_cpus;                  // worker_cpus[i]: CPU of worker i (-1: not pinned)
+
+    /* cgroup CPU quota: at most cpu_limit tasks run at the same time */
+    atomic_int cpu_limit; // Written under lock (thread_count if no quota)
+    int cpu_gated;        // cpu_limit < thread_count: only then tasks count in running (protected by lock)
+    atomic_int running;   // Tasks currently executing (while cpu_gated)
+
+    thread_pool_attr_t attr; // Copy of the attributes used at create
+    char name[12];           // Copy of attr.name
+
+    arg_slab_t arg_slab; // Backing store of thread_pool_arg_alloc
+
+    /* Worker-local context and broadcast */
+    void *local_area;              // All worker_local blocks in one aligned allocation
+    size_t local_stride;           // worker_local_size rounded up to 64
+    int bcast_busy;                // Protected by lock, a broadcast is in flight (one at a time)
+    pthread_cond_t bcast_done;     // bcast_pending dropped to 0, a broadcast was published, bcast_busy or lazy_starting cleared
+    void (*bcast_fn)(void *);      // Protected by lock
+    void *bcast_arg;               // Protected by lock
+    unsigned long bcast_seq;       // Protected by lock, worker runs bcast_fn when bcast_seen != bcast_seq
+    int bcast_pending;             // Protected by lock, workers that still have to run it
+
+    strand_table_t strands; // key -> strand of thread_pool_add_keyed
+    strand_t *strand_deferred;      // Protected by lock, strands waiting for a slot of class 0 (FIFO)
+    strand_t *strand_deferred_last;
+
+    /* Overflow policy (policy and discard protected by lock) */
+    thread_pool_overflow_t overflow_policy;
+    void (*overflow_discard)(void (*function)(void *), void *argument);
+    pthread_cond_t not_full;   // BLOCK: producers wait here
+    int blocked_producers;     // Protected by lock
+    atomic_long overflow_rejected;
+    atomic_long overflow_caller_runs;
+    atomic_long overflow_blocked;
+    atomic_long overflow_dropped;
+
+    /* Submission classes, class 0 is the default ring of thread_pool_add */
+    thread_pool_class_t classes[THREAD_POOL_MAX_CLASSES];
+    int class_count; // Protected by lock
+    int drr_cursor;  // Class being served (protected by lock)
+
+    /* Managed blocking: spares stand in for workers blocked in begin/end_blocking (protected by lock) */
+    pthread_cond_t spare_cond; // Parked spares
+    int blocked;               // Workers inside a blocking section
+    int spares_started;        // Spare threads created (workers[thread_count ..])
+    int spares_active;         // Spares running the worker loop (not parked)
+    int spares_parked;
+    int spare_tokens;          // Unpark requests not yet taken by a parked spare
+
+    /* Help-while-waiting */
+    pthread_cond_t done_cond; // Waiters: a task finished or a task was queued
+    atomic_long outstanding;  // Tasks queued or running (caller-runs tasks are not counted)
+    atomic_int waiters;       // Threads inside a wait API (0: nobody to wake)
+    atomic_int wait_nested;   // Tasks of this pool inside thread_pool_wait (they cannot wait for themselves)
+
+    uint64_t trace_base; // tp_clock_ticks() at creation: time 0 of the trace
+
+    /* Lock-free mirrors of count for thread_pool_get_stats (stored under lock) */
+    atomic_int queue_depth;
+    atomic_int queue_high_water;
+
+#if THREAD_POOL_LOCKPROF
+    thread_pool_lock_prof_t lock_prof[THREAD_POOL_LOCK_SITES];
+#endif
+
+    tp_perf_config_t perf_config; // Events every worker opens
+    int perf_enabled;             // attr.perf_counters and perf_event_open works
+
+    struct thread_pool_monitor *monitor; // Metrics endpoint thread (attr.monitor_path), NULL: off
+    struct thread_pool_watchdog *watchdog; // Slow task watchdog thread (attr.watchdog_budget_ms), NULL: off
+    atomic_long slow_tasks;                // Tasks the watchdog reported
+    int track_tasks;                       // Publish the start time of every task (monitor, watchdog)
 } thread_pool_t;
 
 /* API Declaration */
+int thread_pool_attr_init(thread_pool_attr_t *attr);
+thread_pool_t *thread_pool_create_attr(const thread_pool_attr_t *attr);
 thread_pool_t *thread_pool_create(int thread_count, int queue_size);
+thread_pool_t *thread_pool_create_placed(int thread_count, int queue_size, thread_pool_placement_t placement);
+int thread_pool_get_placement(thread_pool_t *pool, int *cpus, int max);
+thread_pool_t *thread_pool_create_default(int queue_size);
+int thread_pool_refresh_cpu_limit(thread_pool_t *pool);
 int thread_pool_add(thread_pool_t *pool, void (*function)(void *), void *argument);
+int thread_pool_add_inline(thread_pool_t *pool, void (*function)(void *), const void *data, size_t size);
+int thread_pool_add_keyed(thread_pool_t *pool, unsigned long key, void (*function)(void *), void *argument);
 int thread_pool_destroy(thread_pool_t *pool);
+long thread_pool_completed(thread_pool_t *pool);
+int thread_pool_get_stats(thread_pool_t *pool, thread_pool_stats_t *stats); // Lock-free, never takes pool->lock
+int thread_pool_get_latency(thread_pool_t *pool, tp_histogram_t *wait, tp_histogram_t *run); // -1 if TIMESTAMPS=0
+int thread_pool_trace_dump(thread_pool_t *pool, const char *path); // Chrome trace JSON of the recent tasks
+int thread_pool_get_func_stats(thread_pool_t *pool, thread_pool_func_stats_t *out, int max); // Busiest first
+int thread_pool_metrics_write(thread_pool_t *pool, FILE *out); // Prometheus text snapshot, never takes pool->lock
+int thread_pool_monitor_start(thread_pool_t *pool, const char *path); // Serve metrics on a Unix socket (+ SIGUSR1)
+void thread_pool_monitor_stop(thread_pool_t *pool);
+int thread_pool_watchdog_start(thread_pool_t *pool); // Reports to stderr, see attr.watchdog_budget_ms
+void thread_pool_watchdog_stop(thread_pool_t *pool);
+int thread_pool_profile_dump(thread_pool_t *pool, const char *path);                        // Folded stacks of the sampler
+int thread_pool_func_report(thread_pool_t *pool, FILE *out, int top);                      // Table with symbol names
+int thread_pool_get_lock_stats(thread_pool_t *pool, thread_pool_lock_site_t site, thread_pool_lock_stats_t *stats,
+                               tp_histogram_t *wait, tp_histogram_t *hold); // -1 unless LOCKPROF=1
+int thread_pool_set_overflow_policy(thread_pool_t *pool, thread_pool_overflow_t policy,
+                                    void (*discard)(void (*function)(void *), void *argument));
+int thread_pool_get_overflow_stats(thread_pool_t *pool, thread_pool_overflow_stats_t *stats);
+
+/* Weighted fair queueing across submitters */
+int thread_pool_class_create(thread_pool_t *pool, const char *name, int weight, int queue_size);
+int thread_pool_add_class(thread_pool_t *pool, int class_id, void (*function)(void *), void *argument);
+int thread_pool_get_class_stats(thread_pool_t *pool, int class_id, thread_pool_class_stats_t *stats);
+
+/* Bulkheads: classes with a reserved minimum and a maximum share of the workers */
+int thread_pool_class_set_workers(thread_pool_t *pool, int class_id, int min_workers, int max_workers);
+int thread_pool_bulkhead_create(thread_pool_t *pool, const char *name, int min_workers, int max_workers);
+
+/* Help-while-waiting: every wait runs queued tasks instead of sleeping while there are any */
+int thread_pool_run_pending_task(thread_pool_t *pool); // Run one queued task here. 0: ran one, -1: none
+int thread_pool_wait(thread_pool_t *pool);             // Until every task submitted so far is done
+
+/* Group of tasks to wait for together (Ex: the sub-tasks of one request) */
+typedef struct
+{
+    thread_pool_t *pool;
+    atomic_long pending;
+} thread_pool_group_t;
+
+void thread_pool_group_init(thread_pool_group_t *group, thread_pool_t *pool);
+int thread_pool_group_add(thread_pool_group_t *group, void (*function)(void *), void *argument);
+int thread_pool_group_wait(thread_pool_group_t *group);
+int thread_pool_add_wait(thread_pool_t *pool, void (*function)(void *), void *argument); // One task, submit and wait
+
+/* Called by a task around a section that sleeps (I/O, lock, sleep): a spare worker keeps the CPU busy */
+int thread_pool_begin_blocking(void);
+int thread_pool_end_blocking(void);
+
+/* Task arguments without cross-thread malloc/free (free every arg before thread_pool_destroy) */
+void *thread_pool_arg_alloc(thread_pool_t *pool, size_t size);
+void thread_pool_arg_free(void *ptr);
+
+/* Sharded state: a per-worker context, and "run fn once on every worker, then return" */
+void *thread_pool_worker_local(thread_pool_t *pool);
+int thread_pool_broadcast(thread_pool_t *pool, void (*fn)(void *), void *arg);
+
+/* Temporary memory inside a task: released automatically when the task returns (NULL outside a worker) */
+void *thread_pool_scratch_alloc(size_t size);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef TP_CLOCK_H
+#define TP_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
+
+/* Nanoseconds from CLOCK_MONOTONIC (vDSO: no syscall) */
+static inline uint64_t tp_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*  Cheap timestamps for the hot path: the TSC where it is invariant (same rate on every core,
+    keeps counting in deep C-states), otherwise tp_clock_ns(). Only differences are meaningful,
+    convert them with tp_clock_ticks_to_ns(). Call tp_clock_init() once before use
+*/
+extern int tp_clock_use_tsc;
+extern double tp_clock_ns_per_tick;
+
+void tp_clock_init(void); // Thread-safe, calibrates once (~2 ms)
+
+static inline uint64_t tp_clock_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (tp_clock_use_tsc)
+        return __rdtsc();
+#endif
+    return tp_clock_ns();
+}
+
+static inline uint64_t tp_clock_ticks_to_ns(uint64_t ticks)
+{
+    return tp_clock_use_tsc ? (uint64_t)((double)ticks * tp_clock_ns_per_tick) : ticks;
+}
+
+/* Nanoseconds from start to end. Two cores' TSCs may be a few ticks apart: a task enqueued on one core
+ * and started on another can see end < start. That counts as 0, not as a huge unsigned difference
+ */
+static inline uint64_t tp_clock_elapsed_ns(uint64_t start, uint64_t end)
+{
+    return end > start ? tp_clock_ticks_to_ns(end - start) : 0;
+}
+
+#endif
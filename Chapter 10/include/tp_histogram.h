@@ -0,0 +1,41 @@
+#ifndef TP_HISTOGRAM_H
+#define TP_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*  Log-linear (HDR-style) latency histogram in nanoseconds
+    - Values below 2 x TP_HIST_SUB are exact, above that every power of 2 is split into TP_HIST_SUB
+      linear buckets: relative error < 1 / TP_HIST_SUB (about 3%)
+    - One writer (the worker that owns it): relaxed load + store, no locked instruction
+    - Readers merge any number of histograms without stopping the writers
+*/
+#define TP_HIST_SUB_BITS 5
+#define TP_HIST_SUB (1 << TP_HIST_SUB_BITS)
+#define TP_HIST_MAX_BITS 40 // 2^40 ns = 18 minutes, larger values land in the last bucket
+#define TP_HIST_BUCKETS (2 * TP_HIST_SUB + (TP_HIST_MAX_BITS - TP_HIST_SUB_BITS - 1) * TP_HIST_SUB)
+
+typedef struct
+{
+    atomic_long count;
+    atomic_long sum_ns;
+    atomic_long max_ns;
+    atomic_long buckets[TP_HIST_BUCKETS];
+} tp_histogram_t;
+
+void tp_histogram_reset(tp_histogram_t *h); // Not concurrent with a writer
+
+/* Single writer per histogram */
+void tp_histogram_record(tp_histogram_t *h, uint64_t ns);
+
+/* dst += src (dst is usually a private snapshot) */
+void tp_histogram_merge(tp_histogram_t *dst, const tp_histogram_t *src);
+
+/* Value at percentile p (0..100), upper bound of its bucket. 0 if empty */
+uint64_t tp_histogram_percentile(const tp_histogram_t *h, double p);
+
+/* Bucket <-> value, exposed for exporters (Prometheus, ...) */
+int tp_histogram_index(uint64_t ns);
+uint64_t tp_histogram_bucket_upper(int index);
+
+#endif
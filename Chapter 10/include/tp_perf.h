@@ -0,0 +1,43 @@
+#ifndef TP_PERF_H
+#define TP_PERF_H
+
+#include <stdint.h>
+
+/*  Per-thread counters from perf_event_open, opened by the thread they measure (pid 0, any CPU)
+    Slot i is a hardware event, or its software stand-in when the PMU is not available (VM, container):
+
+        slot  hardware          software fallback
+        0     cycles            task-clock (ns on CPU)
+        1     instructions      cpu-migrations
+        2     cache-misses      page-faults
+        3     context-switches  (always software)
+
+    All events of a thread are one group: one read() returns every value, taken at the same instant
+*/
+#define TP_PERF_EVENTS 4
+
+/* Which events to open (chosen once by tp_perf_probe, shared by every worker) */
+typedef struct
+{
+    uint32_t type[TP_PERF_EVENTS];   // PERF_TYPE_*
+    uint64_t config[TP_PERF_EVENTS]; // PERF_COUNT_*
+    int exclude_kernel[TP_PERF_EVENTS];
+    const char *name[TP_PERF_EVENTS];
+    int available[TP_PERF_EVENTS];
+    int hardware; // 1: the PMU works (slot 0 is cycles)
+} tp_perf_config_t;
+
+/* Open counters of one thread */
+typedef struct
+{
+    int count;                 // Events opened, 0: none
+    int fd[TP_PERF_EVENTS];    // fd[0] is the group leader
+    int slot[TP_PERF_EVENTS];  // fd[i] counts event slot[i]
+} tp_perf_t;
+
+int tp_perf_probe(tp_perf_config_t *config); // -1: perf_event_open not usable at all
+int tp_perf_open(tp_perf_t *perf, const tp_perf_config_t *config); // For the calling thread
+int tp_perf_read(const tp_perf_t *perf, uint64_t values[TP_PERF_EVENTS]); // Missing events read 0
+void tp_perf_close(tp_perf_t *perf);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef TP_PROBES_H
+#define TP_PROBES_H
+
+/*  USDT (static tracepoints) of the pool, provider "thread_pool"
+    A probe is one nop in the code plus a note in the ELF: free until a tracer attaches,
+    then bpftrace / perf / systemtap place a breakpoint on it. No rebuild, no tracing mode:
+
+        bpftrace -l 'usdt:./c_thread_pool_demo:thread_pool:*'
+        bpftrace -e 'usdt:./c_thread_pool_demo:thread_pool:exec_start { @wait_ns = hist(arg2); }'
+
+    Arguments are values the pool already has in registers, so enabled or not they cost no extra work.
+    Needs <sys/sdt.h> (systemtap-sdt-dev / systemtap-sdt-devel), otherwise the probes compile to nothing.
+    make USDT=0 removes them even when the header exists
+*/
+
+#ifndef THREAD_POOL_USDT
+#define THREAD_POOL_USDT 1
+#endif
+
+#if THREAD_POOL_USDT && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TP_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef TP_HAVE_USDT
+#define TP_PROBE2(name, a1, a2) DTRACE_PROBE2(thread_pool, name, a1, a2)
+#define TP_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(thread_pool, name, a1, a2, a3)
+#define TP_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(thread_pool, name, a1, a2, a3, a4)
+#else
+#define TP_PROBE2(name, a1, a2) \
+    do                          \
+    {                           \
+    } while (0)
+#define TP_PROBE3(name, a1, a2, a3) \
+    do                              \
+    {                               \
+    } while (0)
+#define TP_PROBE4(name, a1, a2, a3, a4) \
+    do                                  \
+    {                                   \
+    } while (0)
+#endif
+
+/*  Probes (arg0, arg1, ...)
+    enqueue     pool, function, class id, queue depth after the push
+    dequeue     pool, function, class id, queue depth after the take
+    queue_full  pool, function, class id, overflow policy (THREAD_POOL_OVERFLOW_REJECT: the task is refused)
+    exec_start  worker id (-1: helping thread), function, queue wait ns (-1 with TIMESTAMPS=0)
+    exec_end    worker id, function, run time ns (-1 with TIMESTAMPS=0)
+    park        pool, worker id: worker goes to sleep
+    wake        pool, worker id: worker woke up
+*/
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef TP_SAMPLER_H
+#define TP_SAMPLER_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+
+/*  CPU-time sampling profiler, one per worker thread
+    - timer_create(CLOCK_THREAD_CPUTIME_ID) sends SIGPROF to this thread only (SIGEV_THREAD_ID), every
+      1/hz second of CPU the thread used: an idle worker costs nothing and gets no samples
+    - The handler runs on the sampled thread: backtrace() into a local array, then copied into the ring
+      of that thread (preallocated, relaxed stores + release of head, like the task trace)
+    - Per-slot seqlock, like the task trace: seq is 2 x index + 1 while sample `index` is written,
+      2 x index + 2 once done. A reader keeps a copy only if seq was 2 x index + 2 before and after it
+    - Each sample also keeps the task function running at that moment (current_task)
+    SIGPROF is taken for the whole process: do not combine with setitimer(ITIMER_PROF) / gprof
+*/
+#define TP_SAMPLER_DEPTH 32 // Frames kept per sample
+#define TP_SAMPLER_SKIP 2   // Handler + signal trampoline at the top of every backtrace
+
+typedef struct
+{
+    atomic_ulong seq;
+    _Atomic(void *) task; // Task function at the time of the sample, NULL: not in a task
+    atomic_int depth;
+    _Atomic(void *) pcs[TP_SAMPLER_DEPTH]; // Innermost frame first
+} tp_sample_t;
+
+typedef struct
+{
+    tp_sample_t *samples;          // NULL: sampler off
+    unsigned long mask;            // capacity - 1 (power of 2)
+    _Atomic(void *) *current_task; // Where the owner publishes the task it runs
+    timer_t timer;
+    int armed;
+    _Alignas(64) atomic_ulong head; // Samples taken so far
+} tp_sampler_t;
+
+/* Called by the thread to sample: allocate the ring, install the handler (once), start the timer */
+int tp_sampler_start(tp_sampler_t *sampler, int hz, unsigned long capacity, _Atomic(void *) *current_task);
+void tp_sampler_stop(tp_sampler_t *sampler);    // Same thread: delete the timer (ring stays readable)
+void tp_sampler_destroy(tp_sampler_t *sampler); // Any thread, after stop: free the ring
+
+/* Aggregate samples of several samplers as folded stacks ("root;task;outer;...;inner count"),
+ * the input of flamegraph.pl / speedscope / inferno. roots[i] names the first frame of sampler i
+ */
+int tp_sampler_write_folded(FILE *fp, tp_sampler_t *const *samplers, const char *const *roots, int count);
+
+/* One stack of another thread of this process (kernel tid), now: SIGPROF to it, the same handler
+ * copies its backtrace out. Works without a running sampler. Returns the depth, -1 if it did not
+ * answer within timeout_ms (signal blocked, thread gone). Interrupts a sleep of the target (EINTR)
+ */
+int tp_sampler_capture(int tid, void **pcs, int max, int timeout_ms);
+void tp_sampler_write_stack(FILE *fp, const char *indent, void *const *pcs, int depth); // One named frame per line
+const char *tp_sampler_symbol_name(void *pc, char *buf, size_t size); // Like tp_symbol_name, static functions too
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TP_TRACE_H
+#define TP_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+/*  Task timeline: one ring per worker, one event per task (Chrome "complete" event = begin + end)
+    - Single writer (the worker): fill the slot, then publish head (release). No lock, no CAS
+    - A full ring overwrites the oldest events (keeps the most recent window)
+    - Per-slot seqlock: seq is 2 x index + 1 while event `index` is written, 2 x index + 2 once done.
+      A reader keeps a copy only if seq was 2 x index + 2 before and after it (not torn, not a later lap)
+*/
+typedef struct
+{
+    atomic_ulong seq;
+    _Atomic(void *) function;
+    atomic_ulong enqueue_ts; // tp_clock_ticks()
+    atomic_ulong start_ts;
+    atomic_ulong end_ts;
+} tp_trace_event_t;
+
+/* Plain copy of an event (what readers get) */
+typedef struct
+{
+    void *function;
+    uint64_t enqueue_ts;
+    uint64_t start_ts;
+    uint64_t end_ts;
+} tp_trace_record_t;
+
+typedef struct
+{
+    tp_trace_event_t *events; // NULL: tracing off for this ring
+    unsigned long mask;       // capacity - 1 (capacity is a power of 2)
+    _Alignas(64) atomic_ulong head; // Events written so far
+} tp_trace_ring_t;
+
+int tp_trace_ring_init(tp_trace_ring_t *ring, unsigned long capacity);
+void tp_trace_ring_destroy(tp_trace_ring_t *ring);
+
+static inline void tp_trace_record(tp_trace_ring_t *ring, void *function,
+                                   uint64_t enqueue_ts, uint64_t start_ts, uint64_t end_ts)
+{
+    unsigned long h = atomic_load_explicit(&(ring->head), memory_order_relaxed);
+    tp_trace_event_t *e = &(ring->events[h & ring->mask]);
+
+    atomic_store_explicit(&(e->seq), 2 * h + 1, memory_order_relaxed); // Odd: being written
+    atomic_thread_fence(memory_order_release);                          // Odd seq visible before the fields
+    atomic_store_explicit(&(e->function), function, memory_order_relaxed);
+    atomic_store_explicit(&(e->enqueue_ts), enqueue_ts, memory_order_relaxed);
+    atomic_store_explicit(&(e->start_ts), start_ts, memory_order_relaxed);
+    atomic_store_explicit(&(e->end_ts), end_ts, memory_order_relaxed);
+    atomic_store_explicit(&(e->seq), 2 * h + 2, memory_order_release);
+    atomic_store_explicit(&(ring->head), h + 1, memory_order_release);
+}
+
+/* Copy the events still in the ring, oldest first. Return how many were written to out */
+unsigned long tp_trace_ring_snapshot(tp_trace_ring_t *ring, tp_trace_record_t *out, unsigned long max);
+
+/* Function name of a code address (dladdr, needs -rdynamic for static functions), "0x..." if unknown */
+const char *tp_symbol_name(void *addr, char *buf, size_t size);
+
+/* Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) */
+void tp_trace_write_header(FILE *fp);
+void tp_trace_write_thread(FILE *fp, int *first, int tid, const char *name);
+void tp_trace_write_event(FILE *fp, int *first, int tid, const tp_trace_record_t *rec, uint64_t base_ts);
+void tp_trace_write_footer(FILE *fp);
+
+#endif
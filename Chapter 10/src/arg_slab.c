@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "arg_slab.h"
+
+/* Header in front of every block: who owns it and its size class */
+typedef struct
+{
+    arg_cache_t *owner; // NULL: large block from malloc
+    uint32_t size_class;
+    uint32_t pad; // Keep the payload 16-byte aligned
+} arg_header_t;
+
+#define CHUNK_HEADER 16 // First bytes of a chunk link it into cache->chunks
+
+/* 16 -> class 0, 32 -> class 1, ..., 2048 -> class 7 */
+static int size_to_class(size_t size)
+{
+    int c = 0;
+    size_t cap = 16;
+    while (cap < size)
+    {
+        cap <<= 1;
+        c++;
+    }
+    return c;
+}
+
+static size_t class_to_size(int c)
+{
+    return (size_t)16 << c;
+}
+
+/* Key destructor, on the exiting thread: its blocks may still be in flight, so the cache is not freed.
+ * It waits in slab->orphans for a new thread (remote frees keep landing on its remote lists meanwhile)
+ */
+static void arg_cache_orphan(void *ptr)
+{
+    arg_cache_t *cache = ptr;
+    arg_slab_t *slab = cache->slab;
+
+    pthread_mutex_lock(&(slab->orphan_lock));
+    cache->next_orphan = slab->orphans;
+    slab->orphans = cache;
+    pthread_mutex_unlock(&(slab->orphan_lock));
+}
+
+int arg_slab_init(arg_slab_t *slab)
+{
+    if (slab == NULL)
+        return -1;
+
+    atomic_init(&(slab->caches), NULL);
+    slab->orphans = NULL;
+    if (pthread_mutex_init(&(slab->orphan_lock), NULL) != 0)
+        return -1;
+
+    if (pthread_key_create(&(slab->key), arg_cache_orphan) != 0)
+    {
+        pthread_mutex_destroy(&(slab->orphan_lock));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* First allocation of this thread: adopt the cache of an exited thread, else create one and register it
+ * (lock-free push)
+ */
+static arg_cache_t *arg_cache_create(arg_slab_t *slab)
+{
+    pthread_mutex_lock(&(slab->orphan_lock));
+    arg_cache_t *cache = slab->orphans;
+    if (cache != NULL)
+        slab->orphans = cache->next_orphan;
+    pthread_mutex_unlock(&(slab->orphan_lock));
+
+    if (cache != NULL)
+    {
+        pthread_setspecific(slab->key, cache);
+        return cache;
+    }
+
+    cache = aligned_alloc(64, sizeof(arg_cache_t));
+    if (cache == NULL)
+        return NULL;
+
+    memset(cache, 0, sizeof(arg_cache_t));
+    cache->slab = slab;
+    for (int c = 0; c < ARG_SLAB_CLASSES; c++)
+        atomic_init(&(cache->remote_free[c]), NULL);
+
+    arg_cache_t *head = atomic_load(&(slab->caches));
+    do
+    {
+        cache->next_cache = head;
+    } while (!atomic_compare_exchange_weak(&(slab->caches), &head, cache));
+
+    pthread_setspecific(slab->key, cache);
+    return cache;
+}
+
+/* Carve a new block from the current chunk, take a new chunk when it runs out */
+static arg_header_t *arg_cache_carve(arg_cache_t *cache, int c)
+{
+    size_t need = sizeof(arg_header_t) + class_to_size(c);
+
+    if (cache->bump == NULL || (size_t)(cache->bump_end - cache->bump) < need)
+    {
+        char *chunk = malloc(ARG_SLAB_CHUNK);
+        if (chunk == NULL)
+            return NULL;
+
+        *(void **)chunk = cache->chunks;
+        cache->chunks = chunk;
+        cache->bump = chunk + CHUNK_HEADER;
+        cache->bump_end = chunk + ARG_SLAB_CHUNK;
+    }
+
+    arg_header_t *hdr = (arg_header_t *)cache->bump;
+    cache->bump += need;
+    return hdr;
+}
+
+void *arg_slab_alloc(arg_slab_t *slab, size_t size)
+{
+    if (slab == NULL)
+        return NULL;
+
+    /* 1. Large: plain malloc with a header marking "no owner" */
+    if (size > ARG_SLAB_MAX_SIZE)
+    {
+        arg_header_t *hdr = malloc(sizeof(arg_header_t) + size);
+        if (hdr == NULL)
+            return NULL;
+        hdr->owner = NULL;
+        hdr->size_class = 0;
+        return hdr + 1;
+    }
+
+    /* 2. Find the cache of this thread */
+    arg_cache_t *cache = pthread_getspecific(slab->key);
+    if (cache == NULL)
+    {
+        cache = arg_cache_create(slab);
+        if (cache == NULL)
+            return NULL;
+    }
+
+    int c = size_to_class(size);
+    arg_block_t *block = cache->free_list[c];
+
+    /* 3. Local list empty: take everything other threads gave back, in one exchange */
+    if (block == NULL && atomic_load_explicit(&(cache->remote_free[c]), memory_order_relaxed) != NULL)
+        block = atomic_exchange_explicit(&(cache->remote_free[c]), NULL, memory_order_acquire);
+
+    arg_header_t *hdr;
+    if (block != NULL)
+    {
+        cache->free_list[c] = block->next;
+        hdr = (arg_header_t *)block - 1;
+    }
+    else
+    {
+        /* 4. Nothing to reuse: carve (only here we may call malloc for a new chunk) */
+        hdr = arg_cache_carve(cache, c);
+        if (hdr == NULL)
+            return NULL;
+        hdr->owner = cache;
+        hdr->size_class = (uint32_t)c;
+    }
+
+    return hdr + 1;
+}
+
+void arg_slab_free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    arg_header_t *hdr = (arg_header_t *)ptr - 1;
+    arg_cache_t *cache = hdr->owner;
+
+    if (cache == NULL)
+    {
+        free(hdr);
+        return;
+    }
+
+    arg_block_t *block = (arg_block_t *)ptr;
+    int c = (int)hdr->size_class;
+
+    /* 1. Same thread (the cache is the one in our TLS): plain push, no atomics */
+    if (pthread_getspecific(cache->slab->key) == cache)
+    {
+        block->next = cache->free_list[c];
+        cache->free_list[c] = block;
+        return;
+    }
+
+    /* 2. Other thread (the usual case: worker frees producer's arg): lock-free push.
+     * Only the owner pops, and it takes the whole list at once, so there is no ABA problem.
+     */
+    arg_block_t *head = atomic_load_explicit(&(cache->remote_free[c]), memory_order_relaxed);
+    do
+    {
+        block->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&(cache->remote_free[c]), &head, block,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+void arg_slab_destroy(arg_slab_t *slab)
+{
+    if (slab == NULL)
+        return;
+
+    arg_cache_t *cache = atomic_exchange(&(slab->caches), NULL);
+    while (cache != NULL)
+    {
+        arg_cache_t *next = cache->next_cache;
+
+        void *chunk = cache->chunks;
+        while (chunk != NULL)
+        {
+            void *next_chunk = *(void **)chunk;
+            free(chunk);
+            chunk = next_chunk;
+        }
+
+        free(cache);
+        cache = next;
+    }
+
+    pthread_key_delete(slab->key);
+    pthread_mutex_destroy(&(slab->orphan_lock));
+}
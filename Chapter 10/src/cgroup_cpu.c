@@ -0,0 +1,294 @@
+#define _GNU_SOURCE // Enable Linux Extension
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cgroup_cpu.h"
+#include "cpu_topology.h"
+
+#define CG_PATH_MAX 512
+
+/* Mount point and root of one cgroup hierarchy (from /proc/self/mountinfo) */
+typedef struct
+{
+    char mount[CG_PATH_MAX];
+    char root[CG_PATH_MAX];
+    char path[CG_PATH_MAX]; // Our cgroup inside this hierarchy (from /proc/self/cgroup)
+    int found;
+} cg_hierarchy_t;
+
+/* Does the comma list "rw,cpu,cpuacct" contain the token "cpu"? */
+static int has_token(const char *list, const char *token)
+{
+    size_t len = strlen(token);
+    const char *p = list;
+    while (p != NULL && *p != '\0')
+    {
+        if (strncmp(p, token, len) == 0 && (p[len] == ',' || p[len] == '\0' || p[len] == '\n'))
+            return 1;
+        p = strchr(p, ',');
+        if (p != NULL)
+            p++;
+    }
+    return 0;
+}
+
+/* 1. Find where the hierarchy is mounted
+ * v1: fstype "cgroup" with super option "cpu" (or "cpuset")
+ * v2: fstype "cgroup2"
+ */
+static void find_mount(cg_hierarchy_t *h, int version, const char *controller)
+{
+    char line[1024];
+    FILE *fp = fopen("/proc/self/mountinfo", "r");
+    if (fp == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char root[CG_PATH_MAX], mount[CG_PATH_MAX];
+        char *sep = strstr(line, " - ");
+        if (sep == NULL || sscanf(line, "%*s %*s %*s %511s %511s", root, mount) != 2)
+            continue;
+
+        char fstype[64], source[CG_PATH_MAX], options[CG_PATH_MAX];
+        if (sscanf(sep + 3, "%63s %511s %511s", fstype, source, options) != 3)
+            continue;
+
+        if ((version == 2 && strcmp(fstype, "cgroup2") == 0) ||
+            (version == 1 && strcmp(fstype, "cgroup") == 0 && has_token(options, controller)))
+        {
+            snprintf(h->mount, sizeof(h->mount), "%s", mount);
+            snprintf(h->root, sizeof(h->root), "%s", root);
+            h->found = 1;
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+/* 2. Find our cgroup path in /proc/self/cgroup ("0::/path" for v2, "3:cpu,cpuacct:/path" for v1) */
+static void find_path(cg_hierarchy_t *h, int version, const char *controller)
+{
+    char line[1024];
+    FILE *fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL)
+        return;
+
+    h->path[0] = '\0';
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        char *c1 = strchr(line, ':');
+        char *c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+        if (c2 == NULL)
+            continue;
+
+        *c2 = '\0';
+        const char *controllers = c1 + 1;
+        char *path = c2 + 1;
+        path[strcspn(path, "\n")] = '\0';
+
+        if ((version == 2 && strncmp(line, "0:", 2) == 0 && *controllers == '\0') ||
+            (version == 1 && has_token(controllers, controller)))
+        {
+            /* The mount root may already be part of the path (Ex: container with bind mount) */
+            size_t rlen = strlen(h->root);
+            if (rlen > 1 && strncmp(path, h->root, rlen) == 0)
+                path += rlen;
+            snprintf(h->path, sizeof(h->path), "%s", path);
+            break;
+        }
+    }
+    fclose(fp);
+}
+
+static int open_hierarchy(cg_hierarchy_t *h, int version, const char *controller)
+{
+    memset(h, 0, sizeof(*h));
+    find_mount(h, version, controller);
+    if (!h->found)
+        return -1;
+    find_path(h, version, controller);
+    return 0;
+}
+
+/* Build "<mount><path>/<file>", walking up "levels" directories. Return -1 above the mount root */
+static int cg_file(const cg_hierarchy_t *h, int levels, const char *file, char *out, size_t size)
+{
+    char dir[CG_PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", h->path);
+
+    for (int i = 0; i < levels; i++)
+    {
+        char *slash = strrchr(dir, '/');
+        if (slash == NULL || dir[0] == '\0')
+            return -1;
+        *slash = '\0';
+    }
+
+    snprintf(out, size, "%s%s/%s", h->mount, dir, file);
+
+    /* Inside a cgroup namespace the path may not exist under our mount: use the mount root */
+    if (access(out, R_OK) != 0 && levels == 0)
+        snprintf(out, size, "%s/%s", h->mount, file);
+
+    return 0;
+}
+
+/* v2: cpu.max is "max 100000" or "200000 100000". Take the tightest limit up to the root.
+ * Return 0 for no quota, -1 when no cpu.max could be read
+ */
+static double read_quota_v2(const cg_hierarchy_t *h)
+{
+    double best = 0;
+    int read = 0;
+    char path[CG_PATH_MAX * 2];
+
+    for (int lvl = 0; cg_file(h, lvl, "cpu.max", path, sizeof(path)) == 0; lvl++)
+    {
+        char quota[32];
+        long period;
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fscanf(fp, "%31s %ld", quota, &period) == 2)
+        {
+            read = 1;
+            if (strcmp(quota, "max") != 0 && period > 0)
+            {
+                double cpus = atof(quota) / (double)period;
+                if (best == 0 || cpus < best)
+                    best = cpus;
+            }
+        }
+        fclose(fp);
+    }
+    return read ? best : -1;
+}
+
+/* v1: cpu.cfs_quota_us (-1: unlimited) / cpu.cfs_period_us. Same return as read_quota_v2 */
+static double read_quota_v1(const cg_hierarchy_t *h)
+{
+    double best = 0;
+    int read = 0;
+    char path[CG_PATH_MAX * 2];
+
+    for (int lvl = 0; cg_file(h, lvl, "cpu.cfs_quota_us", path, sizeof(path)) == 0; lvl++)
+    {
+        long quota = -1, period = 0;
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fscanf(fp, "%ld", &quota) != 1)
+            quota = -1;
+        fclose(fp);
+
+        cg_file(h, lvl, "cpu.cfs_period_us", path, sizeof(path));
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+        if (fscanf(fp, "%ld", &period) != 1)
+            period = 0;
+        fclose(fp);
+
+        if (period > 0)
+            read = 1;
+        if (quota > 0 && period > 0)
+        {
+            double cpus = (double)quota / (double)period;
+            if (best == 0 || cpus < best)
+                best = cpus;
+        }
+    }
+    return read ? best : -1;
+}
+
+int cgroup_cpu_limit_read(cgroup_cpu_limit_t *limit)
+{
+    cg_hierarchy_t h;
+    char path[CG_PATH_MAX * 2];
+
+    if (limit == NULL)
+        return -1;
+
+    limit->quota_cpus = 0;
+    limit->cpuset_cpus = 0;
+    limit->version = 0;
+    int found = 0; // A quota or a cpuset file was read
+
+    /* 1. Quota: hybrid systems may have both, the smaller one wins */
+    if (open_hierarchy(&h, 2, NULL) == 0)
+    {
+        double q = read_quota_v2(&h);
+        if (q >= 0)
+            found = 1;
+        if (q > 0)
+        {
+            limit->quota_cpus = q;
+            limit->version = 2;
+        }
+
+        if (cg_file(&h, 0, "cpuset.cpus.effective", path, sizeof(path)) == 0)
+        {
+            int n = cpu_topology_count_list(path);
+            if (n >= 0)
+                found = 1;
+            if (n > 0)
+                limit->cpuset_cpus = n;
+        }
+    }
+
+    if (open_hierarchy(&h, 1, "cpu") == 0)
+    {
+        double q = read_quota_v1(&h);
+        if (q >= 0)
+            found = 1;
+        if (q > 0 && (limit->quota_cpus == 0 || q < limit->quota_cpus))
+        {
+            limit->quota_cpus = q;
+            limit->version = 1;
+        }
+    }
+
+    if (limit->cpuset_cpus == 0 && open_hierarchy(&h, 1, "cpuset") == 0)
+    {
+        if (cg_file(&h, 0, "cpuset.effective_cpus", path, sizeof(path)) == 0)
+        {
+            int n = cpu_topology_count_list(path);
+            if (n >= 0)
+                found = 1;
+            if (n > 0)
+                limit->cpuset_cpus = n;
+        }
+    }
+
+    /* Neither file could be read (Ex: no cgroup mounted): the caller picks its own default */
+    if (!found)
+        return -1;
+
+    /* 2. No cpuset info: the affinity mask is the cpuset */
+    if (limit->cpuset_cpus == 0)
+    {
+        cpu_topology_t topo;
+        if (cpu_topology_load(&topo) == 0)
+            limit->cpuset_cpus = topo.count;
+        cpu_topology_free(&topo);
+        if (limit->cpuset_cpus <= 0)
+            limit->cpuset_cpus = 1;
+    }
+
+    /* 3. Effective workers: ceil(quota), never more than the CPUs we can run on */
+    limit->effective = limit->cpuset_cpus;
+    if (limit->quota_cpus > 0)
+    {
+        int q = (int)limit->quota_cpus;
+        if ((double)q < limit->quota_cpus)
+            q++;
+        if (q < limit->effective)
+            limit->effective = q;
+    }
+    if (limit->effective < 1)
+        limit->effective = 1;
+
+    return 0;
+}
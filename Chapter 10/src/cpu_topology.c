@@ -0,0 +1,288 @@
+#define _GNU_SOURCE // Enable Linux Extension (sched_getaffinity, CPU_* macros)
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu_topology.h"
+
+#define SYSFS_CPU "/sys/devices/system/cpu"
+
+/* Read a single integer from a sysfs file, return def if it does not exist */
+static int read_int_file(const char *path, int def)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return def;
+
+    int value;
+    if (fscanf(fp, "%d", &value) != 1)
+        value = def;
+
+    fclose(fp);
+    return value;
+}
+
+/* Parse a sysfs CPU list (Ex: "0-3,8-11") into a cpu_set_t */
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+    char buf[1024];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+
+    if (fgets(buf, sizeof(buf), fp) == NULL)
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    CPU_ZERO(set);
+    char *p = buf;
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long lo = strtol(p, &end, 10);
+        long hi = lo;
+        if (end == p)
+            break;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long c = lo; c <= hi && c < CPU_SETSIZE; c++)
+            CPU_SET(c, set);
+        p = (*end == ',') ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+/* Lowest CPU in a set, -1 if empty */
+static int first_cpu(const cpu_set_t *set)
+{
+    for (int c = 0; c < CPU_SETSIZE; c++)
+    {
+        if (CPU_ISSET(c, set))
+            return c;
+    }
+    return -1;
+}
+
+static void load_cpu_info(cpu_info_t *info, int cpu)
+{
+    char path[256];
+    cpu_set_t set;
+
+    info->cpu = cpu;
+
+    /* 1. Package and core: missing files (old kernel / container) fall back to "every CPU is a core" */
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+    info->package = read_int_file(path, 0);
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+    info->core = read_int_file(path, cpu);
+
+    /* 2. SMT rank: how many siblings of this core come before us */
+    info->smt_rank = 0;
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/thread_siblings_list", cpu);
+    if (read_cpu_list(path, &set) == 0)
+    {
+        for (int c = 0; c < cpu; c++)
+        {
+            if (CPU_ISSET(c, &set))
+                info->smt_rank++;
+        }
+    }
+
+    /* 3. L3 domain: find the cache index with level 3 */
+    info->l3 = -1;
+    for (int idx = 0; idx < 10; idx++)
+    {
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/level", cpu, idx);
+        int level = read_int_file(path, -1);
+        if (level < 0)
+            break;
+        if (level != 3)
+            continue;
+
+        snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/cache/index%d/shared_cpu_list", cpu, idx);
+        if (read_cpu_list(path, &set) == 0)
+            info->l3 = first_cpu(&set);
+        break;
+    }
+}
+
+int cpu_topology_load(cpu_topology_t *topo)
+{
+    cpu_set_t allowed;
+
+    if (topo == NULL)
+        return -1;
+
+    topo->count = 0;
+    topo->cpus = NULL;
+
+    /* 1. Start from the CPUs we may actually run on (taskset / cpuset / container) */
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        perror("sched_getaffinity");
+        return -1;
+    }
+
+    int count = CPU_COUNT(&allowed);
+    topo->cpus = malloc(sizeof(cpu_info_t) * count);
+    if (topo->cpus == NULL)
+        return -1;
+
+    /* 2. Read topology of each allowed CPU */
+    for (int c = 0; c < CPU_SETSIZE && topo->count < count; c++)
+    {
+        if (CPU_ISSET(c, &allowed))
+            load_cpu_info(&topo->cpus[topo->count++], c);
+    }
+
+    return 0;
+}
+
+void cpu_topology_free(cpu_topology_t *topo)
+{
+    if (topo == NULL)
+        return;
+    free(topo->cpus);
+    topo->cpus = NULL;
+    topo->count = 0;
+}
+
+/* Compact: package -> core -> sibling, so siblings are used before the next core */
+static int cmp_compact(const void *a, const void *b)
+{
+    const cpu_info_t *x = a, *y = b;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->smt_rank - y->smt_rank;
+}
+
+/* Scatter: sibling rank first, so every physical core gets one worker before any SMT sibling */
+static int cmp_scatter(const void *a, const void *b)
+{
+    const cpu_info_t *x = a, *y = b;
+    if (x->smt_rank != y->smt_rank)
+        return x->smt_rank - y->smt_rank;
+    if (x->package != y->package)
+        return x->package - y->package;
+    return x->core - y->core;
+}
+
+int cpu_topology_place(const cpu_topology_t *topo, thread_pool_placement_t policy,
+                       int n, int *out_cpus)
+{
+    if (topo == NULL || out_cpus == NULL || n < 0)
+        return -1;
+
+    /* 1. None (or nothing known): leave every worker unpinned */
+    if (policy == THREAD_POOL_PLACE_NONE || topo->count == 0)
+    {
+        for (int i = 0; i < n; i++)
+            out_cpus[i] = -1;
+        return 0;
+    }
+
+    /* 2. Build the preferred CPU order of this policy */
+    cpu_info_t *order = malloc(sizeof(cpu_info_t) * topo->count);
+    if (order == NULL)
+        return -1;
+    memcpy(order, topo->cpus, sizeof(cpu_info_t) * topo->count);
+
+    if (policy == THREAD_POOL_PLACE_COMPACT)
+    {
+        qsort(order, topo->count, sizeof(cpu_info_t), cmp_compact);
+    }
+    else
+    {
+        qsort(order, topo->count, sizeof(cpu_info_t), cmp_scatter);
+    }
+
+    if (policy == THREAD_POOL_PLACE_L3)
+    {
+        /* Round robin over L3 domains, each domain consumed in scatter order */
+        cpu_info_t *rr = malloc(sizeof(cpu_info_t) * topo->count);
+        char *used = calloc(topo->count, 1);
+        if (rr == NULL || used == NULL)
+        {
+            free(rr);
+            free(used);
+            free(order);
+            return -1;
+        }
+
+        int filled = 0;
+        while (filled < topo->count)
+        {
+            /* One pass: take the first unused CPU of every domain not yet visited in this pass */
+            int pass_start = filled;
+            for (int i = 0; i < topo->count; i++)
+            {
+                if (used[i])
+                    continue;
+
+                int seen = 0;
+                for (int j = pass_start; j < filled; j++)
+                {
+                    if (rr[j].l3 == order[i].l3)
+                    {
+                        seen = 1;
+                        break;
+                    }
+                }
+                if (!seen)
+                {
+                    rr[filled++] = order[i];
+                    used[i] = 1;
+                }
+            }
+        }
+
+        free(used);
+        free(order);
+        order = rr;
+    }
+
+    /* 3. Worker i takes the i-th CPU, wrapping when there are more workers than CPUs */
+    for (int i = 0; i < n; i++)
+        out_cpus[i] = order[i % topo->count].cpu;
+
+    free(order);
+    return 0;
+}
+
+int cpu_topology_count_list(const char *path)
+{
+    cpu_set_t list, allowed;
+
+    if (read_cpu_list(path, &list) != 0)
+        return -1;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return CPU_COUNT(&list);
+
+    CPU_AND(&list, &list, &allowed);
+    return CPU_COUNT(&list);
+}
+
+const char *cpu_placement_name(thread_pool_placement_t policy)
+{
+    switch (policy)
+    {
+    case THREAD_POOL_PLACE_NONE:
+        return "none";
+    case THREAD_POOL_PLACE_COMPACT:
+        return "compact";
+    case THREAD_POOL_PLACE_SCATTER:
+        return "scatter";
+    case THREAD_POOL_PLACE_L3:
+        return "l3";
+    }
+    return "unknown";
+}
@@ -0,0 +1,168 @@
+#include <sched.h> // sched_yield
+#include "flat_combining.h"
+
+#define FC_SPINS_BEFORE_YIELD 16
+#define FC_COMBINE_PASSES 3 // Scan again: others publish while we combine
+
+/* TLS value of a thread that found every slot taken: do not search again on every call */
+static char fc_no_slot;
+
+/* Key destructor: the thread exits, its slot (never pending here: execute has returned) is free again */
+static void fc_release_slot(void *ptr)
+{
+    if (ptr == &fc_no_slot)
+        return;
+    fc_slot_t *slot = ptr;
+    atomic_store_explicit(&(slot->owned), 0, memory_order_release);
+}
+
+int flat_combiner_init(flat_combiner_t *fc, void *state)
+{
+    if (fc == NULL)
+        return -1;
+
+    atomic_init(&(fc->lock), 0);
+    atomic_init(&(fc->used), 0);
+    fc->state = state;
+    for (int i = 0; i < FC_MAX_THREADS; i++)
+    {
+        atomic_init(&(fc->slots[i].pending), 0);
+        atomic_init(&(fc->slots[i].owned), 0);
+        fc->slots[i].op = NULL;
+        fc->slots[i].arg = NULL;
+    }
+
+    if (pthread_key_create(&(fc->key), fc_release_slot) != 0)
+        return -1;
+
+    return 0;
+}
+
+void flat_combiner_destroy(flat_combiner_t *fc)
+{
+    if (fc == NULL)
+        return;
+    pthread_key_delete(fc->key);
+}
+
+static int fc_try_lock(flat_combiner_t *fc)
+{
+    /* Read first: do not pull the line in exclusive mode while somebody is combining */
+    return atomic_load_explicit(&(fc->lock), memory_order_relaxed) == 0 &&
+           atomic_exchange_explicit(&(fc->lock), 1, memory_order_acquire) == 0;
+}
+
+static void fc_unlock(flat_combiner_t *fc)
+{
+    atomic_store_explicit(&(fc->lock), 0, memory_order_release);
+}
+
+/* Combiner: run every published operation, in slot order */
+static void fc_combine(flat_combiner_t *fc)
+{
+    int used = atomic_load_explicit(&(fc->used), memory_order_acquire);
+    if (used > FC_MAX_THREADS)
+        used = FC_MAX_THREADS;
+
+    for (int pass = 0; pass < FC_COMBINE_PASSES; pass++)
+    {
+        int applied = 0;
+        for (int i = 0; i < used; i++)
+        {
+            fc_slot_t *slot = &(fc->slots[i]);
+            if (atomic_load_explicit(&(slot->pending), memory_order_acquire) == 0)
+                continue;
+
+            slot->op(fc->state, slot->arg);
+            atomic_store_explicit(&(slot->pending), 0, memory_order_release); // Owner may return now
+            applied++;
+        }
+        if (applied == 0)
+            break;
+    }
+}
+
+/* Slot of this thread, NULL when all FC_MAX_THREADS slots are taken */
+static fc_slot_t *fc_my_slot(flat_combiner_t *fc)
+{
+    fc_slot_t *slot = pthread_getspecific(fc->key);
+    if (slot != NULL)
+        return slot == (fc_slot_t *)&fc_no_slot ? NULL : slot;
+
+    /* 1. A slot given back by an exited thread */
+    int used = atomic_load_explicit(&(fc->used), memory_order_acquire);
+    for (int i = 0; i < used; i++)
+    {
+        int expected = 0;
+        if (atomic_load_explicit(&(fc->slots[i].owned), memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong_explicit(&(fc->slots[i].owned), &expected, 1, memory_order_acquire,
+                                                    memory_order_relaxed))
+        {
+            slot = &(fc->slots[i]);
+            pthread_setspecific(fc->key, slot);
+            return slot;
+        }
+    }
+
+    /* 2. A new one: used only grows while below FC_MAX_THREADS (CAS, never past the array).
+     * Claimed with a CAS too: a thread in step 1 may see the new slot free before we mark it
+     */
+    while (used < FC_MAX_THREADS)
+    {
+        if (!atomic_compare_exchange_weak_explicit(&(fc->used), &used, used + 1, memory_order_acq_rel,
+                                                   memory_order_acquire))
+            continue;
+
+        int expected = 0;
+        slot = &(fc->slots[used]);
+        if (atomic_compare_exchange_strong_explicit(&(slot->owned), &expected, 1, memory_order_acquire,
+                                                    memory_order_relaxed))
+        {
+            pthread_setspecific(fc->key, slot);
+            return slot;
+        }
+        used++; // Taken by a step-1 thread: it has a slot, try the next one
+    }
+
+    /* 3. Full: remember it, this thread takes the plain lock path from now on */
+    pthread_setspecific(fc->key, &fc_no_slot);
+    return NULL;
+}
+
+void flat_combiner_execute(flat_combiner_t *fc, fc_op_t op, void *arg)
+{
+    fc_slot_t *slot = fc_my_slot(fc);
+
+    /* 1. No slot left: behave like a plain spin lock */
+    if (slot == NULL)
+    {
+        while (!fc_try_lock(fc))
+            sched_yield();
+        op(fc->state, arg);
+        fc_unlock(fc);
+        return;
+    }
+
+    /* 2. Publish */
+    slot->op = op;
+    slot->arg = arg;
+    atomic_store_explicit(&(slot->pending), 1, memory_order_release);
+
+    /* 3. Become the combiner, or wait until a combiner did our work */
+    int spins = 0;
+    while (atomic_load_explicit(&(slot->pending), memory_order_acquire) != 0)
+    {
+        if (fc_try_lock(fc))
+        {
+            fc_combine(fc);
+            fc_unlock(fc);
+            continue; // Our slot was in the scan, pending is 0 now
+        }
+
+        if (++spins == FC_SPINS_BEFORE_YIELD)
+        {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
@@ -27,43 +27,92 @@ int main()
 
     // 1. Create Pool (4 threads, Queue size 65536)
     // Bigger Queue can main thread be blocked, for better testing
-    thread_pool_t *pool = thread_pool_create(4, 65536);
+    // Caller-runs: when the queue is full, main runs the task itself instead of spinning
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 4;
+    attr.queue_size = 65536;
+    attr.overflow_policy = THREAD_POOL_OVERFLOW_CALLER_RUNS;
+
+    // THREAD_POOL_TRACE=trace.json ./c_thread_pool_demo: keep the last 64K tasks per worker, dump at the end
+    const char *trace_path = getenv("THREAD_POOL_TRACE");
+    if (trace_path != NULL)
+        attr.trace_capacity = 65536;
+
+    // THREAD_POOL_PERF=1: perf_event_open counters per worker and per task function (2 read() per task)
+    attr.perf_counters = getenv("THREAD_POOL_PERF") != NULL;
+    // THREAD_POOL_PROFILE=1: run time and CPU time per task function ("top tasks")
+    attr.profile_functions = getenv("THREAD_POOL_PROFILE") != NULL;
+    // THREAD_POOL_SAMPLE=stacks.folded: 199 stack samples per CPU second per worker, flamegraph.pl stacks.folded
+    const char *sample_path = getenv("THREAD_POOL_SAMPLE");
+    if (sample_path != NULL)
+        attr.sample_hz = 199;
+    // THREAD_POOL_MONITOR=/tmp/pool.sock: curl --unix-socket /tmp/pool.sock http://x/metrics, or kill -USR1 <pid>
+    attr.monitor_path = getenv("THREAD_POOL_MONITOR");
+    // THREAD_POOL_WATCHDOG_MS=50: report (with a stack) every task that runs longer than 50 ms
+    const char *watchdog_ms = getenv("THREAD_POOL_WATCHDOG_MS");
+    if (watchdog_ms != NULL)
+    {
+        attr.watchdog_budget_ms = atoi(watchdog_ms);
+        attr.watchdog_stacks = 1;
+    }
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
     if (!pool)
         return 1;
 
+    // Placement chosen from the allowed CPU mask (scatter by default)
+    int cpus[4];
+    int placed = thread_pool_get_placement(pool, cpus, 4);
+    printf("[Main] Placement (%s):", cpu_placement_name(pool->placement));
+    for (int i = 0; i < placed; i++)
+        printf(" W%d->CPU%d", i, cpus[i]);
+    printf("\n");
+
     printf("[Main] Dispatching %d tasks...\n", TASKS_COUNT);
     double start = get_time_sec();
 
     // 2. Send Tasks
     for (int i = 0; i < TASKS_COUNT; i++)
     {
-        // If Queue full then retry (Busy Retry)
-        while (thread_pool_add(pool, dummy_task, NULL) != 0)
-        {
-            // Release some CPU for Worker
-            // We don't use usleep, use sched_yield() can create higher performance
-            // To make it simple, we do no-op, let it spin
-        }
+        // No busy retry: a full queue makes main run the task (throttles main, no CPU stolen by spinning)
+        thread_pool_add(pool, dummy_task, NULL);
     }
 
     // 3. Wait for all tasks done
-    // Use atomic counter to check progress, not using sleep to guess the time
-    while (1)
-    {
-        // Atomic Load
-        int completed = atomic_load(&(pool->task_completed)); // Load to int to compare
-        if (completed >= TASKS_COUNT)
-        {
-            break;
-        }
-        // Sleep a while to release some CPU to Worker, don't let Main Occupies
-        usleep(1000);
-    }
+    // Main runs queued tasks too instead of sleeping (help-while-waiting)
+    thread_pool_wait(pool);
 
     double end = get_time_sec();
     double duration = end - start;
 
     // 4. Show the Performance
+    thread_pool_overflow_stats_t overflow;
+    thread_pool_get_overflow_stats(pool, &overflow);
+
+    // Latency histograms (~9 KB each, not on the stack)
+    static tp_histogram_t wait_hist, run_hist;
+    int has_latency = thread_pool_get_latency(pool, &wait_hist, &run_hist) == 0;
+    if (trace_path != NULL && thread_pool_trace_dump(pool, trace_path) == 0)
+        printf("[Main] Trace written to %s (open in ui.perfetto.dev)\n", trace_path);
+    if (sample_path != NULL && thread_pool_profile_dump(pool, sample_path) == 0)
+        printf("[Main] Folded stacks written to %s\n", sample_path);
+
+    // make LOCKPROF=1: who waits on pool->lock, and for how long
+    static tp_histogram_t lock_wait[THREAD_POOL_LOCK_SITES], lock_hold[THREAD_POOL_LOCK_SITES];
+    thread_pool_lock_stats_t lock_stats[THREAD_POOL_LOCK_SITES];
+    // Hardware (or software fallback) counters, read before destroy closes them
+    thread_pool_worker_stats_t worker_stats[4];
+    thread_pool_stats_t stats = {.workers = worker_stats, .workers_capacity = 4};
+    thread_pool_get_stats(pool, &stats);
+    if (attr.profile_functions || attr.perf_counters)
+    {
+        printf("[Main] Top tasks:\n");
+        thread_pool_func_report(pool, stdout, 8);
+    }
+
+    int has_lockprof = 1;
+    for (int s = 0; s < THREAD_POOL_LOCK_SITES; s++)
+        has_lockprof &= thread_pool_get_lock_stats(pool, s, &lock_stats[s], &lock_wait[s], &lock_hold[s]) == 0;
     thread_pool_destroy(pool);
 
     printf("\n========================================\n");
@@ -71,6 +120,45 @@ int main()
     printf("Tasks Processed: %d\n", TASKS_COUNT);
     printf("Time Taken:      %.4f seconds\n", duration);
     printf("Throughput:      %.2f Tasks/Sec\n", TASKS_COUNT / duration);
+    printf("Caller-runs:     %ld\n", overflow.caller_runs);
+    if (has_latency)
+    {
+        printf("Queue wait (us): p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+               tp_histogram_percentile(&wait_hist, 50) / 1e3, tp_histogram_percentile(&wait_hist, 99) / 1e3,
+               tp_histogram_percentile(&wait_hist, 99.9) / 1e3, tp_histogram_percentile(&wait_hist, 100) / 1e3);
+        printf("Run time (ns):   p50 %llu  p99 %llu  p99.9 %llu\n",
+               (unsigned long long)tp_histogram_percentile(&run_hist, 50),
+               (unsigned long long)tp_histogram_percentile(&run_hist, 99),
+               (unsigned long long)tp_histogram_percentile(&run_hist, 99.9));
+    }
+    if (stats.perf_names[0] != NULL)
+    {
+        printf("Perf counters:\n");
+        for (int i = 0; i < stats.worker_count; i++)
+        {
+            printf("  W%d   ", worker_stats[i].id);
+            for (int e = 0; e < TP_PERF_EVENTS; e++)
+                if (stats.perf_names[e] != NULL)
+                    printf(" %s %llu", stats.perf_names[e], (unsigned long long)worker_stats[i].perf[e]);
+            printf("\n");
+        }
+    }
+    if (has_lockprof)
+    {
+        printf("Lock profile (destroy not included):\n");
+        for (int s = 0; s < THREAD_POOL_LOCK_SITES; s++)
+        {
+            if (lock_stats[s].acquired == 0)
+                continue;
+            printf("  %-9s %8ld locks, %6ld contended (%.3f%%), wait p50 %llu p99 %llu ns, hold p50 %llu p99 %llu ns\n",
+                   lock_stats[s].site, lock_stats[s].acquired, lock_stats[s].contended,
+                   100.0 * lock_stats[s].contended / lock_stats[s].acquired,
+                   (unsigned long long)tp_histogram_percentile(&lock_wait[s], 50),
+                   (unsigned long long)tp_histogram_percentile(&lock_wait[s], 99),
+                   (unsigned long long)tp_histogram_percentile(&lock_hold[s], 50),
+                   (unsigned long long)tp_histogram_percentile(&lock_hold[s], 99));
+        }
+    }
     printf("========================================\n");
 
     return 0;
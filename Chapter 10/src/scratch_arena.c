@@ -0,0 +1,95 @@
+#include <sys/mman.h> // mmap, munmap
+#include "scratch_arena.h"
+
+#define SCRATCH_ALIGN 16
+#define CHUNK_HEADER ((sizeof(scratch_chunk_t) + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1))
+
+void scratch_arena_init(scratch_arena_t *arena, size_t chunk_size)
+{
+    arena->head = arena->current = NULL;
+    arena->chunk_size = chunk_size > 0 ? chunk_size : SCRATCH_DEFAULT_CHUNK;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->reserved = 0;
+}
+
+/* mmap instead of malloc: trim really gives the pages back to the OS */
+static scratch_chunk_t *scratch_chunk_new(scratch_arena_t *arena, size_t size)
+{
+    size_t bytes = CHUNK_HEADER + (size > arena->chunk_size ? size : arena->chunk_size);
+    void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return NULL;
+
+    scratch_chunk_t *chunk = (scratch_chunk_t *)mem;
+    chunk->next = NULL;
+    chunk->size = bytes - CHUNK_HEADER;
+    chunk->used = 0;
+    arena->reserved += bytes;
+    return chunk;
+}
+
+void *scratch_arena_alloc(scratch_arena_t *arena, size_t size)
+{
+    size = (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+
+    /* 1. First use: map the first chunk */
+    if (arena->current == NULL)
+    {
+        arena->head = arena->current = scratch_chunk_new(arena, size);
+        if (arena->current == NULL)
+            return NULL;
+    }
+
+    /* 2. Current chunk full: move to the next kept chunk, or map a new one */
+    scratch_chunk_t *chunk = arena->current;
+    while (chunk->size - chunk->used < size)
+    {
+        if (chunk->next == NULL)
+        {
+            chunk->next = scratch_chunk_new(arena, size);
+            if (chunk->next == NULL)
+                return NULL;
+        }
+        chunk = chunk->next;
+        chunk->used = 0;
+        arena->current = chunk;
+    }
+
+    /* 3. Bump */
+    void *ptr = (char *)chunk + CHUNK_HEADER + chunk->used;
+    chunk->used += size;
+    arena->used += size;
+    if (arena->used > arena->high_water)
+        arena->high_water = arena->used;
+
+    return ptr;
+}
+
+void scratch_arena_reset(scratch_arena_t *arena)
+{
+    if (arena->head != NULL)
+        arena->head->used = 0;
+    arena->current = arena->head;
+    arena->used = 0;
+}
+
+void scratch_arena_trim(scratch_arena_t *arena)
+{
+    scratch_chunk_t *chunk = arena->head;
+    while (chunk != NULL)
+    {
+        scratch_chunk_t *next = chunk->next;
+        munmap(chunk, CHUNK_HEADER + chunk->size);
+        chunk = next;
+    }
+
+    arena->head = arena->current = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+void scratch_arena_destroy(scratch_arena_t *arena)
+{
+    scratch_arena_trim(arena);
+}
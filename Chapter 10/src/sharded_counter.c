@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sharded_counter.h"
+
+__thread int sharded_counter_tls_id; // 0: not assigned yet
+
+static atomic_int next_id = 0;
+
+int sharded_counter_init(sharded_counter_t *counter, int shards)
+{
+    if (counter == NULL || shards <= 0)
+        return -1;
+
+    /* Round up to a power of 2: "shard & mask" instead of "shard % shards" on the hot path */
+    int n = 1;
+    while (n < shards)
+        n <<= 1;
+
+    counter->slots = aligned_alloc(64, sizeof(sharded_counter_slot_t) * n);
+    if (counter->slots == NULL)
+        return -1;
+
+    for (int i = 0; i < n; i++)
+        atomic_init(&(counter->slots[i].value), 0);
+    counter->mask = n - 1;
+
+    return 0;
+}
+
+void sharded_counter_destroy(sharded_counter_t *counter)
+{
+    if (counter == NULL)
+        return;
+    free(counter->slots);
+    counter->slots = NULL;
+}
+
+int sharded_counter_assign_id(void)
+{
+    sharded_counter_tls_id = atomic_fetch_add(&next_id, 1) + 1;
+    return sharded_counter_tls_id;
+}
+
+long sharded_counter_read(const sharded_counter_t *counter)
+{
+    long sum = 0;
+    for (int i = 0; i <= counter->mask; i++)
+        sum += atomic_load_explicit(&(counter->slots[i].value), memory_order_relaxed);
+    return sum;
+}
+
+long sharded_counter_read_exact(const sharded_counter_t *counter)
+{
+    long sum = 0;
+    atomic_thread_fence(memory_order_seq_cst);
+    for (int i = 0; i <= counter->mask; i++)
+        sum += atomic_load_explicit(&(counter->slots[i].value), memory_order_acquire);
+    return sum;
+}
@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+#include "strand.h"
+
+int strand_table_init(strand_table_t *table, int capacity)
+{
+    unsigned long n = 1;
+    while (n < (unsigned long)(capacity > 0 ? capacity : STRAND_DEFAULT_CAPACITY))
+        n <<= 1;
+
+    table->buckets = calloc(n, sizeof(strand_bucket_t));
+    if (table->buckets == NULL)
+        return -1;
+    for (unsigned long i = 0; i < n; i++)
+    {
+        if (pthread_mutex_init(&(table->buckets[i].lock), NULL) != 0)
+        {
+            while (i-- > 0)
+                pthread_mutex_destroy(&(table->buckets[i].lock));
+            free(table->buckets);
+            table->buckets = NULL;
+            return -1;
+        }
+    }
+    table->mask = n - 1;
+    return 0;
+}
+
+/* Strands still here had tasks left when the pool was destroyed */
+void strand_table_destroy(strand_table_t *table)
+{
+    if (table->buckets == NULL)
+        return;
+
+    for (unsigned long i = 0; i <= table->mask; i++)
+    {
+        strand_t *strand = table->buckets[i].chain;
+        while (strand != NULL)
+        {
+            strand_t *next = strand->next;
+            free(strand);
+            strand = next;
+        }
+        pthread_mutex_destroy(&(table->buckets[i].lock));
+    }
+    free(table->buckets);
+    table->buckets = NULL;
+}
+
+/* Spread keys like account IDs (1, 2, 3 ...) over the table */
+static unsigned long hash_key(unsigned long key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdUL;
+    key ^= key >> 33;
+    return key;
+}
+
+static strand_t *strand_new(struct thread_pool *pool, unsigned long key)
+{
+    strand_t *strand = aligned_alloc(64, sizeof(strand_t));
+    if (strand == NULL)
+        return NULL;
+
+    memset(strand, 0, sizeof(strand_t));
+    strand->pool = pool;
+    strand->key = key;
+    atomic_init(&(strand->stub.next), NULL);
+    atomic_init(&(strand->tail), &(strand->stub));
+    strand->head = &(strand->stub);
+    atomic_init(&(strand->pending), 0);
+    return strand;
+}
+
+static void strand_push(strand_t *strand, strand_node_t *node);
+
+strand_t *strand_submit(strand_table_t *table, struct thread_pool *pool, unsigned long key, strand_node_t *node,
+                        int *schedule)
+{
+    strand_bucket_t *bucket = &(table->buckets[hash_key(key) & table->mask]);
+
+    pthread_mutex_lock(&(bucket->lock));
+    strand_t *strand = bucket->chain;
+    while (strand != NULL && strand->key != key)
+        strand = strand->next;
+    if (strand == NULL)
+    {
+        strand = strand_new(pool, key);
+        if (strand == NULL)
+        {
+            pthread_mutex_unlock(&(bucket->lock));
+            return NULL;
+        }
+        strand->next = bucket->chain;
+        bucket->chain = strand;
+    }
+
+    /* Under the bucket lock: the runner cannot see pending reach 0 and free the strand meanwhile */
+    strand_push(strand, node);
+    *schedule = atomic_fetch_add_explicit(&(strand->pending), 1, memory_order_acq_rel) == 0;
+    pthread_mutex_unlock(&(bucket->lock));
+    return strand;
+}
+
+int strand_task_done(strand_table_t *table, strand_t *strand)
+{
+    /* 1. More tasks queued: only the runner decrements, pending cannot reach 0 here (no lock) */
+    if (atomic_load_explicit(&(strand->pending), memory_order_acquire) > 1)
+    {
+        atomic_fetch_sub_explicit(&(strand->pending), 1, memory_order_acq_rel);
+        return 0;
+    }
+
+    /* 2. Maybe the last one: decide under the bucket lock, where producers increment */
+    strand_bucket_t *bucket = &(table->buckets[hash_key(strand->key) & table->mask]);
+    pthread_mutex_lock(&(bucket->lock));
+    int idle = atomic_fetch_sub_explicit(&(strand->pending), 1, memory_order_acq_rel) == 1;
+    if (idle)
+    {
+        strand_t **link = &(bucket->chain);
+        while (*link != strand)
+            link = &((*link)->next);
+        *link = strand->next;
+    }
+    pthread_mutex_unlock(&(bucket->lock));
+
+    if (idle)
+        free(strand);
+    return idle;
+}
+
+/* Producers (any thread): one atomic_exchange, then link */
+static void strand_push(strand_t *strand, strand_node_t *node)
+{
+    atomic_store_explicit(&(node->next), NULL, memory_order_relaxed);
+    strand_node_t *prev = atomic_exchange_explicit(&(strand->tail), node, memory_order_acq_rel);
+    atomic_store_explicit(&(prev->next), node, memory_order_release);
+}
+
+/* Consumer (only the worker running the strand).
+ * NULL: empty, or a producer is between exchange and link (caller retries, pending tells it to)
+ */
+strand_node_t *strand_pop(strand_t *strand)
+{
+    strand_node_t *head = strand->head;
+    strand_node_t *next = atomic_load_explicit(&(head->next), memory_order_acquire);
+
+    /* 1. Skip the stub */
+    if (head == &(strand->stub))
+    {
+        if (next == NULL)
+            return NULL;
+        strand->head = next;
+        head = next;
+        next = atomic_load_explicit(&(head->next), memory_order_acquire);
+    }
+
+    /* 2. Normal case: head has a successor */
+    if (next != NULL)
+    {
+        strand->head = next;
+        return head;
+    }
+
+    /* 3. head is the last node: put the stub back behind it so head can be detached */
+    if (head != atomic_load_explicit(&(strand->tail), memory_order_acquire))
+        return NULL;
+
+    strand_push(strand, &(strand->stub));
+
+    next = atomic_load_explicit(&(head->next), memory_order_acquire);
+    if (next != NULL)
+    {
+        strand->head = next;
+        return head;
+    }
+    return NULL;
+}
@@ -1,70 +1,778 @@
 #define _GNU_SOURCE // Enalbe Linux Extension
 #include <sched.h>  // Marcos like: CPU_SET, CPU_ZERO
-#include <unistd.h>
 #include "thread_pool.h"
+#include "tp_probes.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h> // PTHREAD_STACK_MIN
+#include <string.h> // memcpy
+#include <errno.h>  // ETIMEDOUT
+#include <unistd.h> // gettid
+#include <time.h>
+
+/* Worker running on this thread (NULL on main / producer threads) */
+static __thread thread_pool_worker_t *tls_worker;
+static __thread thread_pool_t *tls_helped_pool; // Pool of the task a helping thread runs now (nested wait)
+
+/* Counter with a single writer: plain load + store, no locked instruction */
+static inline void thread_pool_stat_add(atomic_long *counter, long delta)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+/*  pool->lock, with a contention profile per call site when built with LOCKPROF=1
+    POOL_LOCK: try-lock first, only a failed try pays for the timed (measured) blocking lock
+    POOL_HOLD_END / POOL_HOLD_BEGIN: around a condvar wait, sleeping there is not hold time
+*/
+#if THREAD_POOL_LOCKPROF
+static __thread uint64_t tls_lock_acquired; // Ticks when this thread got (or got back) pool->lock
+
+static int thread_pool_lock_prof(thread_pool_t *pool, thread_pool_lock_site_t site)
+{
+    thread_pool_lock_prof_t *prof = &(pool->lock_prof[site]);
+    uint64_t start = 0;
+    int contended = pthread_mutex_trylock(&(pool->lock)) != 0;
+
+    if (contended)
+    {
+        start = tp_clock_ticks();
+        if (pthread_mutex_lock(&(pool->lock)) != 0)
+            return -1;
+    }
+    tls_lock_acquired = tp_clock_ticks();
+
+    /* We hold the lock: one writer at a time, plain load + store is enough */
+    thread_pool_stat_add(&(prof->acquired), 1);
+    if (contended)
+    {
+        thread_pool_stat_add(&(prof->contended), 1);
+        tp_histogram_record(&(prof->wait), tp_clock_elapsed_ns(start, tls_lock_acquired));
+    }
+    return 0;
+}
+
+static void thread_pool_hold_end(thread_pool_t *pool, thread_pool_lock_site_t site)
+{
+    tp_histogram_record(&(pool->lock_prof[site].hold), tp_clock_elapsed_ns(tls_lock_acquired, tp_clock_ticks()));
+}
+
+static int thread_pool_unlock_prof(thread_pool_t *pool, thread_pool_lock_site_t site)
+{
+    thread_pool_hold_end(pool, site);
+    return pthread_mutex_unlock(&(pool->lock));
+}
+
+#define POOL_LOCK_AT(pool, site) thread_pool_lock_prof((pool), (site))
+#define POOL_UNLOCK_AT(pool, site) thread_pool_unlock_prof((pool), (site))
+#define POOL_LOCK(pool, site) POOL_LOCK_AT((pool), THREAD_POOL_LOCK_##site)
+#define POOL_UNLOCK(pool, site) POOL_UNLOCK_AT((pool), THREAD_POOL_LOCK_##site)
+#define POOL_HOLD_END(pool, site) thread_pool_hold_end((pool), THREAD_POOL_LOCK_##site)
+#define POOL_HOLD_BEGIN() (tls_lock_acquired = tp_clock_ticks())
+#else
+#define POOL_LOCK_AT(pool, site) ((void)(site), pthread_mutex_lock(&((pool)->lock)))
+#define POOL_UNLOCK_AT(pool, site) ((void)(site), pthread_mutex_unlock(&((pool)->lock)))
+#define POOL_LOCK(pool, site) pthread_mutex_lock(&((pool)->lock))
+#define POOL_UNLOCK(pool, site) pthread_mutex_unlock(&((pool)->lock))
+#define POOL_HOLD_END(pool, site) ((void)0)
+#define POOL_HOLD_BEGIN() ((void)0)
+#endif
+
+/* Idle period bookkeeping around every sleep of a worker */
+static void thread_pool_stat_park(thread_pool_worker_t *self)
+{
+    TP_PROBE2(park, self->pool, self->id);
+    thread_pool_stat_add(&(self->stats.parks), 1);
+    atomic_store_explicit(&(self->stats.idle_since), (long)tp_clock_ns(), memory_order_relaxed);
+}
+
+static void thread_pool_stat_wake(thread_pool_worker_t *self)
+{
+    long since = atomic_load_explicit(&(self->stats.idle_since), memory_order_relaxed);
+    thread_pool_stat_add(&(self->stats.idle_ns), (long)tp_clock_ns() - since);
+    atomic_store_explicit(&(self->stats.idle_since), 0, memory_order_relaxed);
+    thread_pool_stat_add(&(self->stats.wakeups), 1);
+    TP_PROBE2(wake, self->pool, self->id);
+}
+
+/* Idle worker with scratch memory: sleep at most scratch_idle_ms, then give the memory back */
+static void thread_pool_idle_wait(thread_pool_t *pool, thread_pool_worker_t *self)
+{
+    if (pool->attr.scratch_idle_ms <= 0 || self->scratch.reserved == 0)
+    {
+        POOL_HOLD_END(pool, DEQUEUE);
+        pthread_cond_wait(&(pool->notify), &(pool->lock));
+        POOL_HOLD_BEGIN();
+        return;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline); // notify uses CLOCK_MONOTONIC (see create)
+    deadline.tv_sec += pool->attr.scratch_idle_ms / 1000;
+    deadline.tv_nsec += (long)(pool->attr.scratch_idle_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    POOL_HOLD_END(pool, DEQUEUE);
+    int rc = pthread_cond_timedwait(&(pool->notify), &(pool->lock), &deadline);
+    POOL_HOLD_BEGIN();
+    if (rc == ETIMEDOUT)
+    {
+        /* munmap outside the pool lock, the caller re-checks the queue anyway */
+        POOL_UNLOCK(pool, DEQUEUE);
+        scratch_arena_trim(&(self->scratch));
+        POOL_LOCK(pool, DEQUEUE);
+    }
+}
+
+/* The calling thread is a worker of pool that has not run the current broadcast yet. Called with pool->lock held */
+static int thread_pool_broadcast_due(thread_pool_t *pool)
+{
+    return tls_worker != NULL && tls_worker->pool == pool && tls_worker->bcast_seen != pool->bcast_seq;
+}
+
+/* Run the pending broadcast on this worker. Called and returns with pool->lock held, taken at site */
+static void thread_pool_run_broadcast(thread_pool_t *pool, thread_pool_worker_t *self, thread_pool_lock_site_t site)
+{
+    void (*fn)(void *) = pool->bcast_fn;
+    void *arg = pool->bcast_arg;
+    self->bcast_seen = pool->bcast_seq;
+
+    POOL_UNLOCK_AT(pool, site);
+    fn(arg);
+    POOL_LOCK_AT(pool, site);
+
+    if (--pool->bcast_pending == 0)
+        pthread_cond_broadcast(&(pool->bcast_done));
+}
+
+/* Book a finished task on its class. Called with pool->lock held */
+static void thread_pool_charge_class(thread_pool_t *pool, int cls, long run_ns, long wait_ns)
+{
+    thread_pool_class_t *c = &(pool->classes[cls]);
+
+    /* A capped bulkhead with queued tasks is below its cap again: a sleeping worker may take one */
+    if (c->max_workers > 0 && c->running == c->max_workers && c->count > 0)
+        pthread_cond_signal(&(pool->notify));
+    c->running--;
+    c->completed++;
+    c->deficit -= run_ns;
+    if (wait_ns >= 0)
+    {
+        c->timed++;
+        c->wait_ns_total += wait_ns;
+        if (wait_ns > c->wait_ns_max)
+            c->wait_ns_max = wait_ns;
+    }
+
+    /* Bounded debt: one very long task must not starve its class for ever */
+    long floor = -4L * THREAD_POOL_DRR_QUANTUM_NS * c->weight;
+    if (c->deficit < floor)
+        c->deficit = floor;
+
+    /* Waiters re-check. Only written under the lock: plain load/store, no locked instruction */
+    atomic_store_explicit(&(pool->outstanding),
+                          atomic_load_explicit(&(pool->outstanding), memory_order_relaxed) - 1, memory_order_relaxed);
+    if (atomic_load_explicit(&(pool->waiters), memory_order_relaxed) > 0)
+        pthread_cond_broadcast(&(pool->done_cond));
+}
+
+/* Charge the last task of this worker to its class. Called with pool->lock held */
+static void thread_pool_charge(thread_pool_t *pool, thread_pool_worker_t *self)
+{
+    if (self->charge_class < 0)
+        return;
+
+    thread_pool_charge_class(pool, self->charge_class, self->charge_ns, self->charge_wait_ns);
+    self->charge_class = -1;
+}
+
+/* CPU time of the calling thread (not vDSO: a syscall, only paid with attr.profile_functions) */
+static long thread_pool_thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Add one run of function to the worker's table. Only the owning worker calls this */
+static void thread_pool_func_record(thread_pool_worker_t *self, void (*function)(void *), long run_ns, long cpu_ns,
+                                    const uint64_t before[TP_PERF_EVENTS], const uint64_t after[TP_PERF_EVENTS])
+{
+    uintptr_t h = ((uintptr_t)function >> 4) * 0x9E3779B97F4A7C15ULL; // Fibonacci hashing
+    unsigned int i = (unsigned int)(h >> 32) & (THREAD_POOL_FUNC_SLOTS - 1);
+
+    for (int probe = 0; probe < THREAD_POOL_FUNC_SLOTS; probe++, i = (i + 1) & (THREAD_POOL_FUNC_SLOTS - 1))
+    {
+        thread_pool_func_slot_t *slot = &(self->funcs[i]);
+        void *fn = atomic_load_explicit(&(slot->function), memory_order_relaxed);
+
+        if (fn == NULL)
+        {
+            fn = (void *)function;
+            atomic_store_explicit(&(slot->function), fn, memory_order_release); // Counters are still 0
+        }
+        if (fn != (void *)function)
+            continue;
+
+        thread_pool_stat_add(&(slot->count), 1);
+        thread_pool_stat_add(&(slot->run_ns), run_ns);
+        thread_pool_stat_add(&(slot->cpu_ns), cpu_ns);
+        if (run_ns > atomic_load_explicit(&(slot->run_ns_max), memory_order_relaxed))
+            atomic_store_explicit(&(slot->run_ns_max), run_ns, memory_order_relaxed);
+        for (int e = 0; e < TP_PERF_EVENTS; e++)
+            thread_pool_stat_add(&(slot->perf[e]), (long)(after[e] - before[e]));
+        return;
+    }
+}
+
+/* Run a task taken from a ring. With TIMESTAMPS the task pays its run time in the DRR and is recorded
+ * in the histograms of self (NULL: not a worker), otherwise every task costs one quantum.
+ * Clock reads stay outside the lock
+ */
+static void thread_pool_execute(thread_task_t *task, thread_pool_worker_t *self, long *run_ns, long *wait_ns)
+{
+    int id = self != NULL ? self->id : -1;
+
+    /* Per-function accounting (attr.profile_functions, attr.perf_counters). Wrappers record their user
+     * functions themselves (thread_pool_call_profiled)
+     */
+    int profile = self != NULL && self->funcs != NULL && !(task->flags & THREAD_TASK_INTERNAL);
+    int profile_cpu = profile && self->pool->attr.profile_functions;
+    uint64_t perf_before[TP_PERF_EVENTS];
+    long cpu_before = 0;
+    if (profile)
+    {
+        tp_perf_read(&(self->perf), perf_before); // All 0 without counters
+        if (profile_cpu)
+            cpu_before = thread_pool_thread_cpu_ns();
+    }
+#if THREAD_POOL_TIMESTAMPS
+    uint64_t run_start = tp_clock_ticks();
+    *wait_ns = (long)tp_clock_elapsed_ns(task->enqueue_ts, run_start);
+#else
+    uint64_t run_start = (profile || (self != NULL && self->pool->track_tasks)) ? tp_clock_ticks() : 0;
+    *run_ns = THREAD_POOL_DRR_QUANTUM_NS;
+    *wait_ns = -1;
+#endif
+    TP_PROBE3(exec_start, id, task->function, *wait_ns);
+
+    /* Published for the sampler, the monitor and the watchdog (start first: a reader that sees the task
+     * sees its start). Nested runs restore the outer task, task first: a reader that sees the outer start
+     * sees the outer task too (see thread_pool_watchdog_scan)
+     */
+    void *outer_task = NULL;
+    uint64_t outer_start = 0;
+    if (self != NULL)
+    {
+        outer_task = atomic_load_explicit(&(self->stats.current_task), memory_order_relaxed);
+        outer_start = atomic_load_explicit(&(self->stats.current_start), memory_order_relaxed);
+        atomic_store_explicit(&(self->stats.current_start), run_start, memory_order_relaxed);
+        atomic_store_explicit(&(self->stats.current_task), (void *)task->function, memory_order_release);
+    }
+    (*(task->function))((task->flags & THREAD_TASK_INLINE) ? (void *)task->inline_arg : task->argument);
+    if (self != NULL)
+    {
+        atomic_store_explicit(&(self->stats.current_task), outer_task, memory_order_release);
+        atomic_store_explicit(&(self->stats.current_start), outer_start, memory_order_release);
+    }
+#if THREAD_POOL_TIMESTAMPS
+    uint64_t run_end = tp_clock_ticks();
+    *run_ns = (long)tp_clock_elapsed_ns(run_start, run_end);
+    TP_PROBE3(exec_end, id, task->function, *run_ns);
+    if (self != NULL)
+    {
+        if (self->hist != NULL)
+        {
+            tp_histogram_record(&(self->hist[0]), (uint64_t)*wait_ns);
+            tp_histogram_record(&(self->hist[1]), (uint64_t)*run_ns);
+        }
+        if (self->trace.events != NULL)
+            tp_trace_record(&(self->trace), (void *)task->function, task->enqueue_ts, run_start, run_end);
+    }
+#else
+    long profile_run_ns = profile ? (long)tp_clock_elapsed_ns(run_start, tp_clock_ticks()) : 0;
+    TP_PROBE3(exec_end, id, task->function, -1L);
+#endif
+    (void)id;
+
+    /* Nested runs (a task helping in thread_pool_wait) are included in the outer task too */
+    if (profile)
+    {
+        uint64_t perf_after[TP_PERF_EVENTS];
+        long cpu_ns = profile_cpu ? thread_pool_thread_cpu_ns() - cpu_before : 0;
+        tp_perf_read(&(self->perf), perf_after);
+#if THREAD_POOL_TIMESTAMPS
+        long profile_run_ns = *run_ns;
+#endif
+        thread_pool_func_record(self, task->function, profile_run_ns, cpu_ns, perf_before, perf_after);
+    }
+}
+
+/* Call the user function of a wrapper task (strand, group) so the profile shows it, not the wrapper */
+static void thread_pool_call_profiled(thread_pool_t *pool, void (*function)(void *), void *argument)
+{
+    thread_pool_worker_t *self = tls_worker;
+    if (self == NULL || self->pool != pool || self->funcs == NULL)
+    {
+        function(argument); // Not a worker of this pool (caller-runs, helping thread): no table to record in
+        return;
+    }
+
+    int profile_cpu = pool->attr.profile_functions;
+    uint64_t perf_before[TP_PERF_EVENTS];
+    uint64_t perf_after[TP_PERF_EVENTS];
+    tp_perf_read(&(self->perf), perf_before);
+    long cpu_before = profile_cpu ? thread_pool_thread_cpu_ns() : 0;
+    uint64_t start = tp_clock_ticks();
+
+    function(argument);
+
+    long run_ns = (long)tp_clock_elapsed_ns(start, tp_clock_ticks());
+    long cpu_ns = profile_cpu ? thread_pool_thread_cpu_ns() - cpu_before : 0;
+    tp_perf_read(&(self->perf), perf_after);
+    thread_pool_func_record(self, function, run_ns, cpu_ns, perf_before, perf_after);
+}
+
+/* Enqueue timestamp of a task (0 with TIMESTAMPS=0) */
+static inline uint64_t thread_pool_enqueue_ticks(void)
+{
+#if THREAD_POOL_TIMESTAMPS
+    return tp_clock_ticks();
+#else
+    return 0;
+#endif
+}
+
+static void thread_pool_enqueue_locked(thread_pool_t *pool, int class_id, void (*function)(void *), void *argument,
+                                       const void *data, size_t size, unsigned int flags, uint64_t now);
+static void thread_pool_strand_run(void *arg);
+
+/* A ring slot was freed: a deferred strand takes it, or a producer sleeping in THREAD_POOL_OVERFLOW_BLOCK may.
+ * Called with pool->lock held
+ * Several classes: the producer of this class may not be first in line, wake them all
+ */
+static void thread_pool_slot_freed(thread_pool_t *pool)
+{
+    /* Deferred strands first: their producers already returned, they wait for a slot only */
+    thread_pool_class_t *c = &(pool->classes[0]);
+    while (pool->strand_deferred != NULL && c->count < c->queue_size)
+    {
+        strand_t *strand = pool->strand_deferred;
+        pool->strand_deferred = strand->deferred_next;
+        atomic_store_explicit(&(pool->outstanding), // Counted again by the enqueue
+                              atomic_load_explicit(&(pool->outstanding), memory_order_relaxed) - 1, memory_order_relaxed);
+        thread_pool_enqueue_locked(pool, 0, thread_pool_strand_run, strand, NULL, 0, THREAD_TASK_INTERNAL,
+                                   thread_pool_enqueue_ticks());
+    }
+
+    if (pool->blocked_producers > 0)
+    {
+        if (pool->class_count > 1)
+            pthread_cond_broadcast(&(pool->not_full));
+        else
+            pthread_cond_signal(&(pool->not_full));
+    }
+}
+
+/* Class has a task and is below its worker cap (bulkhead max) */
+static int thread_pool_class_ready(const thread_pool_class_t *c)
+{
+    return c->count > 0 && (c->max_workers == 0 || c->running < c->max_workers);
+}
+
+/* Is there a task a worker may take now? Called with pool->lock held */
+static int thread_pool_has_task(thread_pool_t *pool)
+{
+    if (pool->count == 0)
+        return 0;
+    if (pool->class_count == 1)
+        return thread_pool_class_ready(&(pool->classes[0])); // Class 0 may be capped too (thread_pool_class_set_workers)
+
+    for (int i = 0; i < pool->class_count; i++)
+    {
+        if (thread_pool_class_ready(&(pool->classes[i])))
+            return 1;
+    }
+    return 0; // Only capped bulkheads have work: their own workers take it when they finish
+}
+
+/* Take the next task (thread_pool_has_task). Return its class. Called with pool->lock held
+ * 1. A bulkhead below its reserved minimum goes first: capacity it did not use was only lent
+ * 2. Otherwise Deficit Round Robin: the class under the cursor is served while it has credit,
+ *    then the cursor moves on and the next class earns weight x quantum
+ */
+static int thread_pool_take(thread_pool_t *pool, thread_task_t *task)
+{
+    int id = 0;
+
+    if (pool->class_count > 1)
+    {
+        id = -1;
+        for (int i = 0; i < pool->class_count; i++)
+        {
+            thread_pool_class_t *c = &(pool->classes[i]);
+            if (c->count > 0 && c->running < c->min_workers)
+            {
+                id = i;
+                break;
+            }
+        }
+
+        while (id < 0)
+        {
+            thread_pool_class_t *c = &(pool->classes[pool->drr_cursor]);
+            if (thread_pool_class_ready(c) && c->deficit > 0)
+            {
+                id = pool->drr_cursor;
+                break;
+            }
+
+            /* An empty class keeps no credit: it cannot save up for a burst */
+            if (c->count == 0 && c->deficit > 0)
+                c->deficit = 0;
+
+            pool->drr_cursor = (pool->drr_cursor + 1) % pool->class_count;
+            c = &(pool->classes[pool->drr_cursor]);
+            if (thread_pool_class_ready(c))
+                c->deficit += (long)THREAD_POOL_DRR_QUANTUM_NS * c->weight; // Capped classes do not save up either
+        }
+    }
+
+    thread_pool_class_t *c = &(pool->classes[id]);
+    *task = c->queue[c->head];
+    c->head = (c->head + 1) % c->queue_size;
+    c->count--;
+    c->running++;
+    pool->count--;
+    atomic_store_explicit(&(pool->queue_depth), pool->count, memory_order_relaxed);
+    TP_PROBE4(dequeue, pool, task->function, id, pool->count);
+
+    return id;
+}
+
+/* More spares running than blocked workers to stand in for? Called with pool->lock held */
+static int thread_pool_spare_surplus(thread_pool_t *pool)
+{
+    int target = pool->blocked < pool->attr.max_spares ? pool->blocked : pool->attr.max_spares;
+    return pool->spares_active > target;
+}
+
+/* Retire a spare until thread_pool_begin_blocking needs it again. Called and returns with pool->lock held */
+static void thread_pool_spare_park(thread_pool_t *pool, thread_pool_worker_t *self)
+{
+    pool->spares_active--;
+    pool->spares_parked++;
+    atomic_store_explicit(&(self->stats.parked), 1, memory_order_relaxed);
+
+    while (pool->spare_tokens == 0 && pool->shutdown == 0)
+    {
+        /* Parked spares are still workers for thread_pool_broadcast */
+        if (self->bcast_seen != pool->bcast_seq)
+        {
+            thread_pool_run_broadcast(pool, self, THREAD_POOL_LOCK_DEQUEUE);
+            continue;
+        }
+        thread_pool_stat_park(self);
+        POOL_HOLD_END(pool, DEQUEUE);
+        pthread_cond_wait(&(pool->spare_cond), &(pool->lock));
+        POOL_HOLD_BEGIN();
+        thread_pool_stat_wake(self);
+    }
+
+    pool->spares_parked--;
+    atomic_store_explicit(&(self->stats.parked), 0, memory_order_relaxed);
+    if (pool->spare_tokens > 0)
+        pool->spare_tokens--; // Waker already counted us in spares_active
+}
 
 /* Every thread execute this function after called, until pool is destroyed */
 static void *thread_pool_worker(void *arg)
 {
-    thread_pool_t *pool = (thread_pool_t *)arg;
+    thread_pool_worker_t *self = (thread_pool_worker_t *)arg;
+    thread_pool_t *pool = self->pool;
     thread_task_t task;
 
-    /* Debug Log */
+    tls_worker = self;
+    self->charge_class = -1;
+
+    /* Counters measure the calling thread: open them here, before the slot is published */
+    int perf_open = pool->perf_enabled && tp_perf_open(&(self->perf), &(pool->perf_config)) == 0;
+    if (perf_open || pool->attr.profile_functions)
+        self->funcs = calloc(THREAD_POOL_FUNC_SLOTS, sizeof(thread_pool_func_slot_t));
+#if THREAD_POOL_TIMESTAMPS
+    self->hist = calloc(2, sizeof(tp_histogram_t)); // Non-fatal: no latency from this worker
+#endif
+
+    /* Same for the sampling timer: it follows the CPU time of the thread that creates it (non-fatal) */
+    if (pool->attr.sample_hz > 0)
+        tp_sampler_start(&(self->sampler), pool->attr.sample_hz, pool->attr.sample_capacity, &(self->stats.current_task));
+    self->tid = gettid();
+    atomic_store_explicit(&(self->stats.start_ns), (long)tp_clock_ns(), memory_order_release); // Publishes the slot
+
+    /* Name shows in top -H / perf / gdb */
+    if (pool->attr.name != NULL)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "%s-%d", pool->attr.name, self->id);
+        pthread_setname_np(pthread_self(), name);
+    }
+
+    /* Debug Log: affinity was applied at creation, so this is the pinned core */
     int current_core = sched_getcpu();
     printf("[Worker Debug] Thread ID %lu bound to Core %d\n",
            pthread_self(), current_core);
     while (1)
     {
         /* 1. Lock for Queue */
-        pthread_mutex_lock(&(pool->lock));
+        POOL_LOCK(pool, DEQUEUE);
+        thread_pool_charge(pool, self);
+
+        /* Spare and the blocked workers are back: park */
+        if (self->spare && thread_pool_spare_surplus(pool))
+            thread_pool_spare_park(pool, self);
 
         /* 2. Wait condition
          * If Queue is empty --> wait
          * We use busy waiting here
          */
-        while (pool->count == 0 && pool->shutdown == 0)
+        while ((!thread_pool_has_task(pool) ||
+                (pool->cpu_gated && atomic_load(&(pool->running)) >= atomic_load(&(pool->cpu_limit)))) &&
+               pool->shutdown == 0 && self->bcast_seen == pool->bcast_seq &&
+               !(self->spare && thread_pool_spare_surplus(pool)))
         {
             // Wait mode: (realease lock -> wait -> awake -> get lock)
-            pthread_cond_wait(&(pool->notify), &(pool->lock));
+            pool->idle++;
+            thread_pool_stat_park(self);
+            thread_pool_idle_wait(pool, self);
+            thread_pool_stat_wake(self);
+            pool->idle--;
         }
 
         /* 3. Judge if shutdown */
         if (pool->shutdown)
         {
-            pthread_mutex_unlock(&(pool->lock));
+            POOL_UNLOCK(pool, DEQUEUE);
+            tp_sampler_stop(&(self->sampler));
             pthread_exit(NULL); // thread exit
         }
 
-        /* 4. Consume a task */
-        task.function = pool->queue[pool->head].function;
-        task.argument = pool->queue[pool->head].argument;
+        /* Broadcast first: thread_pool_broadcast waits for every worker */
+        if (self->bcast_seen != pool->bcast_seq)
+        {
+            thread_pool_run_broadcast(pool, self, THREAD_POOL_LOCK_DEQUEUE);
+            POOL_UNLOCK(pool, DEQUEUE);
+            continue;
+        }
+
+        /* Woken up to retire (see thread_pool_end_blocking) */
+        if (self->spare && thread_pool_spare_surplus(pool))
+        {
+            POOL_UNLOCK(pool, DEQUEUE);
+            continue;
+        }
 
-        pool->head = (pool->head + 1) % pool->queue_size;
-        pool->count--;
+        /* 4. Consume a task (inline args are copied out with it: same cache line, slot is reused after unlock) */
+        int cls = thread_pool_take(pool, &task);
+        /* No quota below thread_count (the usual case): skip the shared counter, it is a contended line */
+        self->cpu_counted = pool->cpu_gated;
+        if (self->cpu_counted)
+            atomic_fetch_add(&(pool->running), 1);
+        thread_pool_slot_freed(pool);
 
         /* 5. Unlock */
-        pthread_mutex_unlock(&(pool->lock));
+        POOL_UNLOCK(pool, DEQUEUE);
+
+        /* 6. Execute (charged to the class when we take the lock again) */
+        thread_pool_execute(&task, self, &(self->charge_ns), &(self->charge_wait_ns));
+        self->charge_class = cls;
+        thread_pool_stat_add(&(self->stats.tasks), 1);
+
+        /* Everything from thread_pool_scratch_alloc is gone now */
+        if (self->scratch.used > 0)
+            scratch_arena_reset(&(self->scratch));
 
-        /* 6. Execute */
-        (*(task.function))(task.argument);
+        /* A worker may be parked because running hit cpu_limit: wake it (under lock, no lost wakeup) */
+        if (self->cpu_counted && atomic_fetch_sub(&(pool->running), 1) == atomic_load(&(pool->cpu_limit)))
+        {
+            POOL_LOCK(pool, DEQUEUE);
+            pthread_cond_signal(&(pool->notify));
+            POOL_UNLOCK(pool, DEQUEUE);
+        }
 
         /* TODO: Chapter 10. Atomic Add */
-        /* This line can speed up to 10x compare to Mutex Lock */
-        atomic_fetch_add(&(pool->task_completed), 1);
+        /* This line can speed up to 10x compare to Mutex Lock, and the slot is only written by this worker */
+        sharded_counter_add_at(&(pool->task_completed), self->id, 1);
     }
 
     return NULL;
 }
 
+#define THREAD_POOL_DEFAULT_STACK (256 * 1024) // Tasks are small, 8 MB x hundreds of workers is a waste
+#define THREAD_POOL_DEFAULT_SPARES 8            // Spare workers created only when tasks really block
+
+int thread_pool_attr_init(thread_pool_attr_t *attr)
+{
+    if (attr == NULL)
+        return -1;
+
+    attr->thread_count = 4;
+    attr->queue_size = 1024;
+    attr->stack_size = THREAD_POOL_DEFAULT_STACK;
+    attr->placement = THREAD_POOL_PLACE_SCATTER; // One worker per physical core before any SMT sibling
+    attr->name = NULL;
+    attr->lazy_start = 0;
+    attr->scratch_chunk_size = SCRATCH_DEFAULT_CHUNK;
+    attr->scratch_idle_ms = 0;
+    attr->worker_local_size = 0;
+    attr->strand_capacity = STRAND_DEFAULT_CAPACITY;
+    attr->overflow_policy = THREAD_POOL_OVERFLOW_REJECT; // Same as before: -2 when full
+    attr->overflow_discard = NULL;
+    attr->max_spares = THREAD_POOL_DEFAULT_SPARES;
+    attr->trace_capacity = 0;
+    attr->perf_counters = 0;
+    attr->profile_functions = 0;
+    attr->sample_hz = 0;
+    attr->sample_capacity = 4096;
+    attr->monitor_path = NULL;
+    attr->watchdog_budget_ms = 0;
+    attr->watchdog_stacks = 0;
+
+    return 0;
+}
+
+/* Create worker i: stack size and affinity are set BEFORE it runs (pthread_attr_setaffinity_np) */
+/* Slot i before its thread exists. Called with pool->lock held (bcast_seq) */
+static void thread_pool_prepare_worker(thread_pool_t *pool, int i)
+{
+    thread_pool_worker_t *worker = &(pool->workers[i]);
+
+    worker->pool = pool;
+    worker->id = i;
+    worker->cpu = pool->worker_cpus[i];
+    scratch_arena_init(&(worker->scratch), pool->attr.scratch_chunk_size);
+    worker->local = pool->local_area ? (char *)pool->local_area + (size_t)i * pool->local_stride : NULL;
+    worker->bcast_seen = pool->bcast_seq; // Only broadcasts issued after start concern this worker
+    worker->spare = i >= pool->thread_count;
+}
+
+/* Thread of a prepared slot. Needs no lock: nobody else touches the slot until it is counted in started */
+static int thread_pool_create_thread(thread_pool_t *pool, thread_pool_worker_t *worker)
+{
+    pthread_attr_t tattr;
+    int i = worker->id;
+
+#if THREAD_POOL_TIMESTAMPS
+    /* Ring only for workers that really start (spares may never) */
+    if (pool->attr.trace_capacity > 0 && worker->trace.events == NULL)
+        tp_trace_ring_init(&(worker->trace), pool->attr.trace_capacity); // Non-fatal: no trace for this worker
+#endif
+
+    if (pthread_attr_init(&tattr) != 0)
+        return -1;
+
+    size_t stack = pool->attr.stack_size;
+    if (stack > 0)
+    {
+        if (stack < (size_t)PTHREAD_STACK_MIN)
+            stack = PTHREAD_STACK_MIN;
+        pthread_attr_setstacksize(&tattr, stack);
+    }
+
+    /* THREAD_POOL_PLACE_NONE: keep the inherited mask */
+    if (worker->cpu >= 0)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(worker->cpu, &cpuset);
+        pthread_attr_setaffinity_np(&tattr, sizeof(cpu_set_t), &cpuset);
+    }
+
+    int rc = pthread_create(&(worker->thread), &tattr, thread_pool_worker, (void *)worker);
+    if (rc != 0 && worker->cpu >= 0)
+    {
+        /* CPU went offline / not allowed anymore: start unpinned (non-fatal) */
+        pthread_attr_destroy(&tattr);
+        pthread_attr_init(&tattr);
+        if (stack > 0)
+            pthread_attr_setstacksize(&tattr, stack);
+        worker->cpu = pool->worker_cpus[i] = -1;
+        rc = pthread_create(&(worker->thread), &tattr, thread_pool_worker, (void *)worker);
+    }
+    pthread_attr_destroy(&tattr);
+    return rc != 0 ? -1 : 0;
+}
+
+/* Prepare, create and count worker i. Called with pool->lock held */
+static int thread_pool_start_worker(thread_pool_t *pool, int i)
+{
+    thread_pool_prepare_worker(pool, i);
+    if (thread_pool_create_thread(pool, &(pool->workers[i])) != 0)
+        return -1;
+
+    if (pool->workers[i].spare)
+        pool->spares_started++;
+    else
+        pool->started++;
+    return 0;
+}
+
+/* lazy_start, second half: the producer reserved slot i under the lock (lazy_starting), the thread is created
+ * here without it, so other submitters do not wait behind pthread_create (non-fatal if it fails)
+ */
+static void thread_pool_lazy_start(thread_pool_t *pool, int i)
+{
+    int rc = thread_pool_create_thread(pool, &(pool->workers[i]));
+
+    POOL_LOCK(pool, ADD);
+    if (rc == 0)
+        pool->started++;
+    pool->lazy_starting = 0;
+    pthread_cond_broadcast(&(pool->bcast_done)); // thread_pool_broadcast / destroy wait for it
+    POOL_UNLOCK(pool, ADD);
+}
+
 thread_pool_t *thread_pool_create(int thread_count, int queue_size)
 {
-    if (thread_count <= 0 || queue_size <= 0)
+    return thread_pool_create_placed(thread_count, queue_size, THREAD_POOL_PLACE_SCATTER);
+}
+
+thread_pool_t *thread_pool_create_placed(int thread_count, int queue_size, thread_pool_placement_t placement)
+{
+    thread_pool_attr_t attr;
+
+    thread_pool_attr_init(&attr);
+    attr.thread_count = thread_count;
+    attr.queue_size = queue_size;
+    attr.placement = placement;
+
+    return thread_pool_create_attr(&attr);
+}
+
+/* Ring of queue_size slots starting on a cache line: malloc only gives 16 bytes, and then every
+ * 64-byte slot would straddle two lines. aligned_alloc wants a multiple of the alignment
+ */
+static thread_task_t *thread_pool_ring_alloc(int queue_size)
+{
+    size_t bytes = (sizeof(thread_task_t) * (size_t)queue_size + 63) & ~(size_t)63;
+    return (thread_task_t *)aligned_alloc(64, bytes);
+}
+
+thread_pool_t *thread_pool_create_attr(const thread_pool_attr_t *attr)
+{
+    if (attr == NULL || attr->thread_count <= 0 || attr->queue_size <= 0 || attr->max_spares < 0)
         return NULL;
 
-    /* 1. Allocate thread pool */
-    thread_pool_t *pool = malloc(sizeof(thread_pool_t));
+    int thread_count = attr->thread_count;
+    int queue_size = attr->queue_size;
+    int worker_slots = thread_count + attr->max_spares; // Spares live after the regular workers
+
+    tp_clock_init(); // Task timestamps use the TSC when it is invariant
+
+    /* 1. Allocate thread pool (calloc: every pointer starts NULL for err_cleanup) */
+    thread_pool_t *pool = calloc(1, sizeof(thread_pool_t));
     if (pool == NULL)
     {
         perror("Failed to allocate thread pool.");
@@ -72,123 +780,551 @@ thread_pool_t *thread_pool_create(int thread_count, int queue_size)
     }
 
     /* 2. Initialize variables */
-    pool->thread_count = 0;
+    pool->attr = *attr;
+    if (attr->name != NULL)
+    {
+        /* Thread names are at most 15 chars, keep room for "-<i>" */
+        snprintf(pool->name, sizeof(pool->name), "%s", attr->name);
+        pool->attr.name = pool->name;
+    }
+    pool->thread_count = thread_count;
+    pool->started = 0;
+    pool->idle = 0;
     pool->queue_size = queue_size;
-    pool->head = pool->tail = pool->count = 0;
+    pool->count = 0;
     pool->shutdown = 0;
+    pool->placement = attr->placement;
+    pool->overflow_policy = attr->overflow_policy;
+    pool->overflow_discard = attr->overflow_discard;
+    pool->blocked_producers = 0;
+    atomic_init(&(pool->overflow_rejected), 0);
+    atomic_init(&(pool->overflow_caller_runs), 0);
+    atomic_init(&(pool->overflow_blocked), 0);
+    atomic_init(&(pool->overflow_dropped), 0);
+    atomic_init(&(pool->cpu_limit), thread_count);
+    pool->cpu_gated = 0;
+    atomic_init(&(pool->running), 0);
+    atomic_init(&(pool->outstanding), 0);
+    atomic_init(&(pool->waiters), 0);
+    atomic_init(&(pool->wait_nested), 0);
+    atomic_init(&(pool->queue_depth), 0);
+    pool->trace_base = tp_clock_ticks();
+    pool->perf_enabled = attr->perf_counters && tp_perf_probe(&(pool->perf_config)) == 0;
+    pool->track_tasks = attr->monitor_path != NULL || attr->watchdog_budget_ms > 0; // Start time even with TIMESTAMPS=0
+    atomic_init(&(pool->slow_tasks), 0);
+    atomic_init(&(pool->queue_high_water), 0);
 
-    /* TODO: Chapter 10. Initialize task_complete */
-    atomic_init(&(pool->task_completed), 0); // Not pool->task_completed = 0
+    /* Class 0: the ring of thread_pool_add (calloc zeroed the counters) */
+    snprintf(pool->classes[0].name, sizeof(pool->classes[0].name), "default");
+    pool->classes[0].weight = 1;
+    pool->classes[0].queue_size = queue_size;
+    pool->class_count = 1;
+    pool->drr_cursor = 0;
 
-    /* 3. Allocate Arrays (Threads & Queue) */
-    pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);
-    pool->queue = (thread_task_t *)malloc(sizeof(thread_task_t) * queue_size);
+    /* 3. Allocate Arrays (Workers & Queue & Placement) */
+    /* 64-byte aligned: the stats of every worker sit on their own cache lines */
+    pool->workers = (thread_pool_worker_t *)aligned_alloc(64, sizeof(thread_pool_worker_t) * worker_slots);
+    if (pool->workers != NULL)
+        memset(pool->workers, 0, sizeof(thread_pool_worker_t) * worker_slots);
+    pool->classes[0].queue = thread_pool_ring_alloc(queue_size);
+    pool->worker_cpus = (int *)malloc(sizeof(int) * worker_slots);
 
-    if (pool->threads == NULL || pool->queue == NULL)
+    /* TODO: Chapter 10. Initialize task_complete (one slot per worker) */
+    if (pool->workers == NULL || pool->classes[0].queue == NULL || pool->worker_cpus == NULL ||
+        sharded_counter_init(&(pool->task_completed), worker_slots) != 0 ||
+        strand_table_init(&(pool->strands), attr->strand_capacity) != 0)
     {
         perror("Failed to allocate threads or queue.");
         goto err_cleanup;
     }
 
-    /* 4. Initialize Lock & Conditional Variable */
-    if (pthread_mutex_init(&(pool->lock), NULL) != 0 || pthread_cond_init(&(pool->notify), NULL) != 0)
+    /* 4. Initialize Lock & Conditional Variable & Argument slabs */
+    /* CLOCK_MONOTONIC: idle timeouts must not jump with the wall clock */
+    /* One label per step: a failure undoes exactly what was initialized before it, in reverse order */
+    if (pthread_mutex_init(&(pool->lock), NULL) != 0)
     {
         perror("Failed to init mutex lock or cond");
         goto err_cleanup;
     }
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    int notify_rc = pthread_cond_init(&(pool->notify), &cattr);
+    pthread_condattr_destroy(&cattr);
+    if (notify_rc != 0)
+    {
+        perror("Failed to init mutex lock or cond");
+        goto err_lock;
+    }
+    if (pthread_cond_init(&(pool->not_full), NULL) != 0)
+    {
+        perror("Failed to init mutex lock or cond");
+        goto err_notify;
+    }
+    if (pthread_cond_init(&(pool->spare_cond), NULL) != 0)
+    {
+        perror("Failed to init mutex lock or cond");
+        goto err_not_full;
+    }
+    if (pthread_cond_init(&(pool->done_cond), NULL) != 0)
+    {
+        perror("Failed to init mutex lock or cond");
+        goto err_spare_cond;
+    }
+    if (pthread_cond_init(&(pool->bcast_done), NULL) != 0)
+    {
+        perror("Failed to init broadcast cond");
+        goto err_done_cond;
+    }
 
-    /* TODO: Chapter 7. Get the cores of CPU / Add CPU Affinity */
-    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
-
-    for (int i = 0; i < thread_count; i++)
+    /* Worker-local blocks: rounded to 64 bytes, so two workers never share a cache line */
+    if (attr->worker_local_size > 0)
     {
-        if (pthread_create(&(pool->threads[i]), NULL, thread_pool_worker, (void *)pool) != 0)
+        pool->local_stride = (attr->worker_local_size + 63) & ~(size_t)63;
+        pool->local_area = aligned_alloc(64, pool->local_stride * worker_slots);
+        if (pool->local_area == NULL)
         {
-            // Trouble shooting
-            return NULL;
+            perror("Failed to allocate worker local area");
+            goto err_bcast_done;
         }
+        memset(pool->local_area, 0, pool->local_stride * worker_slots);
+    }
 
-        /* Add CPU Affinity */
-        /* 7-1: Announce spu_set_t variable (Bitmask) */
-        cpu_set_t cpuset;
-
-        /* 7-2: Clean set */
-        CPU_ZERO(&cpuset);
-
-        /* 7-3: Define which core to allocate (Round Robin) */
-        int target_core = i % num_cores;
+    if (arg_slab_init(&(pool->arg_slab)) != 0)
+    {
+        perror("Failed to init argument slab");
+        goto err_local_area;
+    }
 
-        /* 7-4: Add target core into set */
-        CPU_SET(target_core, &cpuset);
+    /* 5. Decide placement from the allowed CPU mask and sysfs topology */
+    /* Not i % _SC_NPROCESSORS_ONLN: under taskset / containers that targets CPUs we may not use */
+    cpu_topology_t topo;
+    if (cpu_topology_load(&topo) != 0 ||
+        cpu_topology_place(&topo, pool->placement, thread_count, pool->worker_cpus) != 0)
+    {
+        /* Topology unknown: fall back to no pinning (non-fatal) */
+        for (int i = 0; i < thread_count; i++)
+            pool->worker_cpus[i] = -1;
+    }
+    cpu_topology_free(&topo);
 
-        /* 7-5: Call Linux Affinity */
-        /* Parameters:
-         * 1. thread ID
-         * 2. size of cpuset
-         * 3. pointer to cpuset
-         */
-        int rc = pthread_setaffinity_np(pool->threads[i], sizeof(cpu_set_t), &cpuset);
+    /* Spares are not pinned: they run wherever the blocked worker left a CPU idle */
+    for (int i = thread_count; i < worker_slots; i++)
+        pool->worker_cpus[i] = -1;
 
-        if (rc != 0)
-        {
-            perror("Failed to set affinity (non-fatal)");
-        }
-        else
+    /* 6. Start workers (lazy_start: thread_pool_add starts them on demand) */
+    int eager = attr->lazy_start ? 0 : thread_count;
+    for (int i = 0; i < eager; i++)
+    {
+        if (thread_pool_start_worker(pool, i) != 0)
         {
-            // printf("Thread %d bound to Core %d\n", i, target_core);
+            perror("Failed to create worker thread");
+            thread_pool_destroy(pool); // Joins the workers already started
+            return NULL;
         }
     }
 
-    /* Successfully activate all worker threads*/
-    pool->thread_count = thread_count;
+    /* 7. Metrics endpoint and watchdog (non-fatal: the pool works without them) */
+    if (attr->monitor_path != NULL && thread_pool_monitor_start(pool, attr->monitor_path) != 0)
+        perror("Failed to start metrics endpoint");
+    if (attr->watchdog_budget_ms > 0 && thread_pool_watchdog_start(pool) != 0)
+        perror("Failed to start watchdog");
 
     return pool;
 
+err_local_area:
+    free(pool->local_area);
+err_bcast_done:
+    pthread_cond_destroy(&(pool->bcast_done));
+err_done_cond:
+    pthread_cond_destroy(&(pool->done_cond));
+err_spare_cond:
+    pthread_cond_destroy(&(pool->spare_cond));
+err_not_full:
+    pthread_cond_destroy(&(pool->not_full));
+err_notify:
+    pthread_cond_destroy(&(pool->notify));
+err_lock:
+    pthread_mutex_destroy(&(pool->lock));
 err_cleanup:
     /* Handle allocate errors: free all resource*/
-    if (pool->threads)
-        free(pool->threads);
-    if (pool->queue)
-        free(pool->queue);
+    if (pool->workers)
+        free(pool->workers);
+    for (int i = 0; i < pool->class_count; i++)
+        free(pool->classes[i].queue); // Only class 0 exists yet, NULL if its allocation failed
+    if (pool->worker_cpus)
+        free(pool->worker_cpus);
+    sharded_counter_destroy(&(pool->task_completed));
+    strand_table_destroy(&(pool->strands));
     free(pool);
     return NULL;
 }
 
-int thread_pool_add(thread_pool_t *pool, void (*function)(void *), void *argument)
+/* Report the chosen mapping: cpus[i] is the CPU of worker i (-1: not pinned) */
+int thread_pool_get_placement(thread_pool_t *pool, int *cpus, int max)
 {
-    if (pool == NULL || function == NULL)
+    if (pool == NULL || cpus == NULL || max < 0)
+        return -1;
+
+    int n = pool->thread_count < max ? pool->thread_count : max;
+    for (int i = 0; i < n; i++)
+        cpus[i] = pool->worker_cpus[i];
+
+    return n;
+}
+
+/* CPUs this process may use: the cgroup limit, or the affinity mask when there is no cgroup to read */
+static int thread_pool_cpu_budget(void)
+{
+    cgroup_cpu_limit_t limit;
+    if (cgroup_cpu_limit_read(&limit) == 0)
+        return limit.effective;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0)
+        return CPU_COUNT(&allowed);
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
+
+/* Size the pool from the cgroup: Kubernetes gives 2 CPUs of quota on a 64-core node => 2 workers */
+thread_pool_t *thread_pool_create_default(int queue_size)
+{
+    /* Fewer workers than CPUs in the cpuset: scatter them over physical cores */
+    return thread_pool_create_placed(thread_pool_cpu_budget(), queue_size, THREAD_POOL_PLACE_SCATTER);
+}
+
+/* Re-read the quota (Ex: after "kubectl set resources").
+ * The thread count is fixed, so a smaller quota caps how many tasks run at once instead.
+ * Return the new limit
+ */
+int thread_pool_refresh_cpu_limit(thread_pool_t *pool)
+{
+    if (pool == NULL)
+        return -1;
+
+    int budget = thread_pool_cpu_budget();
+    int new_limit = budget < pool->thread_count ? budget : pool->thread_count;
+
+    pthread_mutex_lock(&(pool->lock));
+    atomic_store(&(pool->cpu_limit), new_limit);
+    pool->cpu_gated = new_limit < pool->thread_count; // Tasks already running keep their cpu_counted
+    pthread_cond_broadcast(&(pool->notify)); // Limit may have grown: let parked workers retry
+    pthread_mutex_unlock(&(pool->lock));
+
+    return new_limit;
+}
+
+/* Task did not get a slot and runs right here on the submitting thread (caller-runs) */
+static void thread_pool_run_on_caller(thread_pool_t *pool, void (*function)(void *), void *argument,
+                                      const void *data, size_t size)
+{
+    thread_task_t task; // Same rule as in the ring: the task gets a writable copy of inline data
+
+    if (data != NULL)
     {
-        return -1; // Invalid arguments
+        memcpy(task.inline_arg, data, size);
+        argument = task.inline_arg;
     }
 
-    /* 1. Lock (protect queue structure) */
-    if (pthread_mutex_lock(&(pool->lock)) != 0)
+    function(argument);
+    sharded_counter_add(&(pool->task_completed), 1);
+
+    /* The task may have finished a group somebody waits for */
+    if (atomic_load(&(pool->waiters)) > 0)
     {
-        return -1;
+        pthread_mutex_lock(&(pool->lock));
+        pthread_cond_broadcast(&(pool->done_cond));
+        pthread_mutex_unlock(&(pool->lock));
     }
+}
 
-    /* 2. Check if Queue is full */
-    if (pool->count == pool->queue_size)
+/* DROP_OLDEST: take the oldest task that is not THREAD_TASK_INTERNAL out of the ring (called with lock held).
+ * A strand runner or a group wrapper carries other tasks and a pending count: dropping it would hang them.
+ * The tasks in front of the victim move up one slot. -1: every queued task is internal
+ */
+static int thread_pool_drop_oldest(thread_pool_t *pool, thread_pool_class_t *c, thread_task_t *dropped)
+{
+    int pos = c->head;
+    int n = 0;
+    while (n < c->count && (c->queue[pos].flags & THREAD_TASK_INTERNAL))
     {
-        pthread_mutex_unlock(&(pool->lock));
-        return -2; // -2: Full queue
+        pos = (pos + 1) % c->queue_size;
+        n++;
     }
+    if (n == c->count)
+        return -1;
 
-    /* 3. Add task in tail */
-    pool->queue[pool->tail].function = function;
-    pool->queue[pool->tail].argument = argument;
+    *dropped = c->queue[pos];
+    while (pos != c->head)
+    {
+        int prev = (pos + c->queue_size - 1) % c->queue_size;
+        c->queue[pos] = c->queue[prev];
+        pos = prev;
+    }
+    c->head = (c->head + 1) % c->queue_size;
+    c->count--;
+    pool->count--;
+    atomic_store_explicit(&(pool->queue_depth), pool->count, memory_order_relaxed);
+    atomic_store_explicit(&(pool->outstanding), // Never runs
+                          atomic_load_explicit(&(pool->outstanding), memory_order_relaxed) - 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&(pool->overflow_dropped), 1, memory_order_relaxed);
+    return 0;
+}
+
+/* Write one task at the tail of class class_id (not full) and wake a worker. Called with pool->lock held */
+static void thread_pool_enqueue_locked(thread_pool_t *pool, int class_id, void (*function)(void *), void *argument,
+                                       const void *data, size_t size, unsigned int flags, uint64_t now)
+{
+    thread_pool_class_t *c = &(pool->classes[class_id]);
+    thread_task_t *slot = &(c->queue[c->tail]);
+#if !THREAD_POOL_TIMESTAMPS
+    (void)now;
+#endif
+    slot->function = function;
+    if (data != NULL)
+    {
+        memcpy(slot->inline_arg, data, size);
+        slot->flags = THREAD_TASK_INLINE | flags;
+    }
+    else
+    {
+        slot->argument = argument;
+        slot->flags = flags;
+    }
+#if THREAD_POOL_TIMESTAMPS
+    slot->enqueue_ts = now;
+#endif
 
     /* Update tail (Ring Buffer/Circular Logic) */
-    pool->tail = (pool->tail + 1) % pool->queue_size;
+    c->tail = (c->tail + 1) % c->queue_size;
+    c->count++;
     pool->count++;
+    atomic_store_explicit(&(pool->queue_depth), pool->count, memory_order_relaxed);
+    if (pool->count > atomic_load_explicit(&(pool->queue_high_water), memory_order_relaxed))
+        atomic_store_explicit(&(pool->queue_high_water), pool->count, memory_order_relaxed);
+    TP_PROBE4(enqueue, pool, function, class_id, pool->count);
+    atomic_store_explicit(&(pool->outstanding),
+                          atomic_load_explicit(&(pool->outstanding), memory_order_relaxed) + 1, memory_order_relaxed);
 
     /* Chapter 4: Comes a new task, call a worker thread */
     pthread_cond_signal(&(pool->notify));
 
+    /* Threads in thread_pool_wait / group_wait can run it too (waiters++ happens before their locked re-check) */
+    if (atomic_load_explicit(&(pool->waiters), memory_order_relaxed) > 0)
+        pthread_cond_broadcast(&(pool->done_cond));
+}
+
+/* Put one task in the ring of class class_id. data != NULL: copy size bytes into the slot instead of storing argument.
+ * use_policy = 0: internal callers, a full queue always returns -2. flags: THREAD_TASK_INTERNAL or 0
+ */
+static int thread_pool_push(thread_pool_t *pool, int class_id, void (*function)(void *), void *argument,
+                            const void *data, size_t size, int use_policy, unsigned int flags)
+{
+    thread_task_t dropped;
+    int has_dropped = 0;
+    uint64_t now = thread_pool_enqueue_ticks(); // Outside the lock (TSC: a few ns)
+
+    /* 1. Lock (protect queue structure) */
+    if (POOL_LOCK(pool, ADD) != 0)
+    {
+        return -1;
+    }
+
+    if (class_id < 0 || class_id >= pool->class_count)
+    {
+        POOL_UNLOCK(pool, ADD);
+        return -1; // Unknown class
+    }
+    thread_pool_class_t *c = &(pool->classes[class_id]);
+
+    /* 2. Check if Queue is full, then apply the overflow policy.
+     * A loop: a producer woken from BLOCK may find the ring full again, or a new policy to apply
+     */
+    while (c->count == c->queue_size)
+    {
+        thread_pool_overflow_t policy = use_policy ? pool->overflow_policy : THREAD_POOL_OVERFLOW_REJECT;
+        TP_PROBE4(queue_full, pool, function, class_id, (int)policy);
+
+        switch (policy)
+        {
+        case THREAD_POOL_OVERFLOW_CALLER_RUNS:
+            /* The producer does the work itself: it cannot submit faster than it can run (natural throttle) */
+            POOL_UNLOCK(pool, ADD);
+            atomic_fetch_add_explicit(&(pool->overflow_caller_runs), 1, memory_order_relaxed);
+            thread_pool_run_on_caller(pool, function, argument, data, size);
+            return 0;
+
+        case THREAD_POOL_OVERFLOW_BLOCK:
+            /* Sleep until a worker takes a task (no spinning), or the policy is changed */
+            atomic_fetch_add_explicit(&(pool->overflow_blocked), 1, memory_order_relaxed);
+            pool->blocked_producers++;
+            POOL_HOLD_END(pool, ADD);
+            while (c->count == c->queue_size && pool->shutdown == 0 && pool->overflow_policy == THREAD_POOL_OVERFLOW_BLOCK)
+                pthread_cond_wait(&(pool->not_full), &(pool->lock));
+            POOL_HOLD_BEGIN();
+            pool->blocked_producers--;
+
+            if (pool->shutdown)
+            {
+                POOL_UNLOCK(pool, ADD);
+                return -1;
+            }
+            continue; // Check again: full again (another producer won), or the new policy decides
+
+        case THREAD_POOL_OVERFLOW_DROP_OLDEST:
+            /* Newest work wins: take the oldest user task out, the discard callback gets it after unlock */
+            if (thread_pool_drop_oldest(pool, c, &dropped) == 0)
+            {
+                has_dropped = 1;
+                break;
+            }
+            /* fall through - only internal tasks are queued, none may be dropped: reject */
+
+        case THREAD_POOL_OVERFLOW_REJECT:
+        default:
+            POOL_UNLOCK(pool, ADD);
+            if (use_policy)
+                atomic_fetch_add_explicit(&(pool->overflow_rejected), 1, memory_order_relaxed);
+            return -2; // -2: Full queue
+        }
+    }
+
+    /* 3. Add task in tail */
+    thread_pool_enqueue_locked(pool, class_id, function, argument, data, size, flags, now);
+
+    /* lazy_start: nobody is idle to take it, reserve one more worker (created after the unlock) */
+    int lazy_slot = -1;
+    if (pool->started < pool->thread_count && pool->idle == 0 && pool->lazy_starting == 0)
+    {
+        lazy_slot = pool->started;
+        pool->lazy_starting = 1;
+        thread_pool_prepare_worker(pool, lazy_slot);
+    }
+
+    void (*discard)(void (*)(void *), void *) = pool->overflow_discard;
+
     /* 5. Unlock */
-    pthread_mutex_unlock(&(pool->lock));
+    POOL_UNLOCK(pool, ADD);
+
+    if (lazy_slot >= 0)
+        thread_pool_lazy_start(pool, lazy_slot);
+
+    /* 6. Let the owner of the dropped task release its argument */
+    if (has_dropped && discard != NULL)
+        discard(dropped.function, (dropped.flags & THREAD_TASK_INLINE) ? (void *)dropped.inline_arg : dropped.argument);
+
+    return 0;
+}
+
+int thread_pool_add(thread_pool_t *pool, void (*function)(void *), void *argument)
+{
+    if (pool == NULL || function == NULL)
+    {
+        return -1; // Invalid arguments
+    }
+
+    return thread_pool_push(pool, 0, function, argument, NULL, 0, 1, 0);
+}
+
+/* Copy a small argument into the ring slot: no malloc, no free, the task gets a pointer to the copy.
+ * The copy is only valid while the task runs (do not keep the pointer)
+ */
+int thread_pool_add_inline(thread_pool_t *pool, void (*function)(void *), const void *data, size_t size)
+{
+    if (pool == NULL || function == NULL || data == NULL || size > THREAD_POOL_INLINE_ARG_SIZE)
+    {
+        return -1; // Invalid arguments (too big: use thread_pool_arg_alloc)
+    }
+
+    return thread_pool_push(pool, 0, function, NULL, data, size, 1, 0);
+}
+
+/* Put the runner of strand into class 0. Not the pool policy: a strand is never rejected, dropped or run by
+ * the caller. Ring full: it waits in pool->strand_deferred, the next freed slot is its (thread_pool_slot_freed)
+ */
+static void thread_pool_strand_schedule(thread_pool_t *pool, strand_t *strand)
+{
+    if (thread_pool_push(pool, 0, thread_pool_strand_run, strand, NULL, 0, 0, THREAD_TASK_INTERNAL) == 0)
+        return;
+
+    POOL_LOCK(pool, ADD);
+    thread_pool_class_t *c = &(pool->classes[0]);
+    if (c->count < c->queue_size && pool->strand_deferred == NULL)
+    {
+        thread_pool_enqueue_locked(pool, 0, thread_pool_strand_run, strand, NULL, 0, THREAD_TASK_INTERNAL,
+                                   thread_pool_enqueue_ticks()); // A slot was freed meanwhile
+    }
+    else
+    {
+        /* Still outstanding for thread_pool_wait: its tasks are not done */
+        strand->deferred_next = NULL;
+        if (pool->strand_deferred == NULL)
+            pool->strand_deferred = strand;
+        else
+            pool->strand_deferred_last->deferred_next = strand;
+        pool->strand_deferred_last = strand;
+        atomic_store_explicit(&(pool->outstanding),
+                              atomic_load_explicit(&(pool->outstanding), memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+    POOL_UNLOCK(pool, ADD);
+}
+
+/* One strand = one task in the ring: run up to STRAND_BATCH of its tasks in order, then give way */
+static void thread_pool_strand_run(void *arg)
+{
+    strand_t *strand = (strand_t *)arg;
+    thread_pool_t *pool = strand->pool;
+
+    for (int n = 0; n < STRAND_BATCH; n++)
+    {
+        /* pending > 0, so a node is there (maybe still being linked by its producer) */
+        strand_node_t *node;
+        while ((node = strand_pop(strand)) == NULL)
+            sched_yield();
+
+        void (*function)(void *) = node->function;
+        void *argument = node->argument;
+        thread_pool_arg_free(node);
+
+        thread_pool_call_profiled(pool, function, argument);
+
+        /* Last one: the strand is freed, the next task of this key creates a new one */
+        if (strand_task_done(&(pool->strands), strand))
+            return;
+    }
+
+    /* Still busy: back to the end of the queue, so one hot key cannot hold a worker forever */
+    thread_pool_strand_schedule(pool, strand);
+}
 
-    /* pthread_cond_signal */
+/* Tasks with the same key run in submission order, one at a time. Different keys run in parallel */
+int thread_pool_add_keyed(thread_pool_t *pool, unsigned long key, void (*function)(void *), void *argument)
+{
+    if (pool == NULL || function == NULL)
+    {
+        return -1; // Invalid arguments
+    }
+
+    strand_node_t *node = thread_pool_arg_alloc(pool, sizeof(strand_node_t));
+    if (node == NULL)
+        return -1;
+    node->function = function;
+    node->argument = argument;
+
+    /* 1. Queue the task on the strand of this key (created if the key has no task in flight) */
+    int schedule;
+    strand_t *strand = strand_submit(&(pool->strands), pool, key, node, &schedule);
+    if (strand == NULL)
+    {
+        thread_pool_arg_free(node);
+        return -1; // Out of memory
+    }
+
+    /* 2. The strand was idle: schedule it. The one who moves pending 0 -> 1 owns this */
+    if (schedule)
+        thread_pool_strand_schedule(pool, strand);
 
     return 0;
 }
@@ -198,8 +1334,12 @@ int thread_pool_destroy(thread_pool_t *pool)
     if (pool == NULL)
         return -1;
 
+    /* 0. Metrics endpoint and watchdog first: they read the workers without the lock */
+    thread_pool_monitor_stop(pool);
+    thread_pool_watchdog_stop(pool);
+
     /* 1. Get Lock */
-    if (pthread_mutex_lock(&(pool->lock)) != 0)
+    if (POOL_LOCK(pool, DESTROY) != 0)
     {
         return -1;
     }
@@ -207,34 +1347,917 @@ int thread_pool_destroy(thread_pool_t *pool)
     /* 2. Set shoutdown flag, so that worker leaves while loop */
     pool->shutdown = 1;
 
-    /* 3. Wake all sleep workers */
+    /* 3. Wake all sleep workers (and producers blocked on a full queue) */
     if (pthread_cond_broadcast(&(pool->notify)) != 0)
     {
-        pthread_mutex_unlock(&(pool->lock)); // Unlock before every return
+        POOL_UNLOCK(pool, DESTROY); // Unlock before every return
         return -1;
     }
+    pthread_cond_broadcast(&(pool->not_full));
+    pthread_cond_broadcast(&(pool->spare_cond));
+    pthread_cond_broadcast(&(pool->done_cond));
+
+    /* A producer creating a worker outside the lock: it must be counted in started before the joins */
+    while (pool->lazy_starting)
+    {
+        POOL_HOLD_END(pool, DESTROY);
+        pthread_cond_wait(&(pool->bcast_done), &(pool->lock));
+        POOL_HOLD_BEGIN();
+    }
 
     /* 4. Unlock to let worker threads join */
     /* If you don't unlock first, worker cannot get lock when awake, cannot correctly check shutdown == 1 */
     /* Cause deadlock in main thread */
-    pthread_mutex_unlock(&(pool->lock));
+    POOL_UNLOCK(pool, DESTROY);
 
-    for (int i = 0; i < pool->thread_count; i++)
+    for (int i = 0; i < pool->started; i++)
     {
-        if (pthread_join(pool->threads[i], NULL) != 0)
+        if (pthread_join(pool->workers[i].thread, NULL) != 0)
         {
             // Realistic, here will have log
         }
     }
+    for (int i = 0; i < pool->spares_started; i++)
+        pthread_join(pool->workers[pool->thread_count + i].thread, NULL);
 
     /* 5. Resource recycle */
+    for (int i = 0; i < pool->started; i++)
+        scratch_arena_destroy(&(pool->workers[i].scratch));
+    for (int i = 0; i < pool->spares_started; i++)
+        scratch_arena_destroy(&(pool->workers[pool->thread_count + i].scratch));
+#if THREAD_POOL_TIMESTAMPS
+    for (int i = 0; i < pool->thread_count + pool->attr.max_spares; i++)
+    {
+        tp_trace_ring_destroy(&(pool->workers[i].trace));
+        free(pool->workers[i].hist);
+    }
+#endif
+    for (int i = 0; i < pool->thread_count + pool->attr.max_spares; i++)
+    {
+        tp_perf_close(&(pool->workers[i].perf));
+        free(pool->workers[i].funcs);
+        tp_sampler_destroy(&(pool->workers[i].sampler));
+    }
     pthread_mutex_destroy(&(pool->lock));
     pthread_cond_destroy(&(pool->notify));
+    pthread_cond_destroy(&(pool->not_full));
+    pthread_cond_destroy(&(pool->spare_cond));
+    pthread_cond_destroy(&(pool->done_cond));
+    pthread_cond_destroy(&(pool->bcast_done));
+    arg_slab_destroy(&(pool->arg_slab));
+    free(pool->local_area);
 
     /* 6. Free Memory */
-    free(pool->queue);
-    free(pool->threads);
+    for (int i = 0; i < pool->class_count; i++)
+        free(pool->classes[i].queue);
+    free(pool->workers);
+    free(pool->worker_cpus);
+    sharded_counter_destroy(&(pool->task_completed));
+    strand_table_destroy(&(pool->strands));
     free(pool);
 
     return 0;
 }
+
+/* Change what thread_pool_add does when the ring is full */
+int thread_pool_set_overflow_policy(thread_pool_t *pool, thread_pool_overflow_t policy,
+                                    void (*discard)(void (*function)(void *), void *argument))
+{
+    if (pool == NULL)
+        return -1;
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->overflow_policy = policy;
+    pool->overflow_discard = discard;
+    pthread_cond_broadcast(&(pool->not_full)); // Leaving BLOCK: blocked producers apply the new policy
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+int thread_pool_get_overflow_stats(thread_pool_t *pool, thread_pool_overflow_stats_t *stats)
+{
+    if (pool == NULL || stats == NULL)
+        return -1;
+
+    stats->rejected = atomic_load_explicit(&(pool->overflow_rejected), memory_order_relaxed);
+    stats->caller_runs = atomic_load_explicit(&(pool->overflow_caller_runs), memory_order_relaxed);
+    stats->blocked = atomic_load_explicit(&(pool->overflow_blocked), memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&(pool->overflow_dropped), memory_order_relaxed);
+
+    return 0;
+}
+
+/* New submission class (tenant). weight: share of worker time relative to the other classes
+ * (weight 3 vs weight 1 => 75% / 25% while both have work). queue_size <= 0: same as the default ring.
+ * Return the class id for thread_pool_add_class, -1 on error
+ */
+int thread_pool_class_create(thread_pool_t *pool, const char *name, int weight, int queue_size)
+{
+    if (pool == NULL || weight <= 0)
+        return -1;
+
+    if (queue_size <= 0)
+        queue_size = pool->queue_size;
+
+    /* Ring allocated before the class is visible to workers */
+    thread_task_t *queue = thread_pool_ring_alloc(queue_size);
+    if (queue == NULL)
+        return -1;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (pool->class_count == THREAD_POOL_MAX_CLASSES)
+    {
+        pthread_mutex_unlock(&(pool->lock));
+        free(queue);
+        return -1;
+    }
+
+    int id = pool->class_count;
+    thread_pool_class_t *c = &(pool->classes[id]);
+    memset(c, 0, sizeof(*c));
+    snprintf(c->name, sizeof(c->name), "%s", name != NULL ? name : "class");
+    c->weight = weight;
+    c->queue = queue;
+    c->queue_size = queue_size;
+    pool->class_count++;
+    pthread_mutex_unlock(&(pool->lock));
+
+    return id;
+}
+
+/* Same as thread_pool_add, in the ring of one class (the pool overflow policy applies per class) */
+int thread_pool_add_class(thread_pool_t *pool, int class_id, void (*function)(void *), void *argument)
+{
+    if (pool == NULL || function == NULL)
+    {
+        return -1; // Invalid arguments
+    }
+
+    return thread_pool_push(pool, class_id, function, argument, NULL, 0, 1, 0);
+}
+
+/* Turn a class into a bulkhead: min_workers are reserved for it (lent to others while it has no work),
+ * it never runs on more than max_workers at once (0: no cap).
+ * The reserved minimums of all classes must fit in the pool
+ */
+int thread_pool_class_set_workers(thread_pool_t *pool, int class_id, int min_workers, int max_workers)
+{
+    if (pool == NULL || min_workers < 0 || max_workers < 0 || (max_workers > 0 && min_workers > max_workers))
+        return -1;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (class_id < 0 || class_id >= pool->class_count)
+    {
+        pthread_mutex_unlock(&(pool->lock));
+        return -1;
+    }
+
+    int reserved = min_workers;
+    for (int i = 0; i < pool->class_count; i++)
+    {
+        if (i != class_id)
+            reserved += pool->classes[i].min_workers;
+    }
+    if (reserved > pool->thread_count)
+    {
+        pthread_mutex_unlock(&(pool->lock));
+        return -1; // Over-reserved: some bulkhead could never get its minimum
+    }
+
+    pool->classes[class_id].min_workers = min_workers;
+    pool->classes[class_id].max_workers = max_workers;
+    pthread_cond_broadcast(&(pool->notify)); // A larger cap may free queued tasks
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+/* Named sub-pool sharing the workers (and the placement) of this pool: a class with worker limits */
+int thread_pool_bulkhead_create(thread_pool_t *pool, const char *name, int min_workers, int max_workers)
+{
+    int id = thread_pool_class_create(pool, name, min_workers > 0 ? min_workers : 1, 0);
+    if (id < 0)
+        return -1;
+
+    if (thread_pool_class_set_workers(pool, id, min_workers, max_workers) != 0)
+        return -1; // The class stays, without limits (classes are never removed)
+
+    return id;
+}
+
+/* Run one queued task on the calling thread (Chapter 2, now for every waiter). Return 0 if a task ran, -1 if none.
+ * The caller is not a worker: the task does not count against cpu_limit, scratch memory is not available
+ * (unless the caller is itself a task of this pool)
+ */
+int thread_pool_run_pending_task(thread_pool_t *pool)
+{
+    thread_task_t task;
+    long run_ns, wait_ns;
+
+    if (pool == NULL)
+        return -1;
+
+    POOL_LOCK(pool, HELP);
+
+    /* Check if empty (or only capped bulkheads have work) */
+    if (pool->shutdown || !thread_pool_has_task(pool))
+    {
+        POOL_UNLOCK(pool, HELP);
+        return -1; // Empty
+    }
+
+    /* 1. Consume task, same choice as a worker (bulkheads, DRR) */
+    int cls = thread_pool_take(pool, &task);
+    thread_pool_slot_freed(pool);
+    POOL_UNLOCK(pool, HELP);
+
+    /* 2. Execute (After UNLOCK, such that avoid deadlock) */
+    thread_pool_t *outer_pool = tls_helped_pool;
+    tls_helped_pool = pool;
+    thread_pool_execute(&task, (tls_worker != NULL && tls_worker->pool == pool) ? tls_worker : NULL, &run_ns, &wait_ns);
+    tls_helped_pool = outer_pool;
+
+    POOL_LOCK(pool, HELP);
+    thread_pool_charge_class(pool, cls, run_ns, wait_ns);
+    POOL_UNLOCK(pool, HELP);
+
+    sharded_counter_add(&(pool->task_completed), 1);
+    if (tls_worker != NULL && tls_worker->pool == pool)
+    {
+        thread_pool_stat_add(&(tls_worker->stats.tasks), 1);
+        thread_pool_stat_add(&(tls_worker->stats.helped), 1);
+    }
+    return 0;
+}
+
+/* Wait until done(ctx), running queued tasks meanwhile. Sleep only when there is nothing to run */
+static int thread_pool_help_until(thread_pool_t *pool, int (*done)(thread_pool_t *, void *), void *ctx)
+{
+    int rc = 0;
+
+    atomic_fetch_add(&(pool->waiters), 1); // Before the first check: finishing tasks see us (no lost wakeup)
+    while (!done(pool, ctx))
+    {
+        if (thread_pool_run_pending_task(pool) == 0)
+            continue;
+
+        POOL_LOCK(pool, HELP);
+        POOL_HOLD_END(pool, HELP);
+        while (!done(pool, ctx) && !thread_pool_has_task(pool) && pool->shutdown == 0 && !thread_pool_broadcast_due(pool))
+            pthread_cond_wait(&(pool->done_cond), &(pool->lock));
+        POOL_HOLD_BEGIN();
+        if (pool->shutdown)
+            rc = -1;
+        else if (thread_pool_broadcast_due(pool))
+            thread_pool_run_broadcast(pool, tls_worker, THREAD_POOL_LOCK_HELP); // The broadcaster waits for us too
+        POOL_UNLOCK(pool, HELP);
+
+        if (rc != 0)
+            break;
+    }
+    atomic_fetch_sub(&(pool->waiters), 1);
+
+    return rc;
+}
+
+/* Outside the pool: everything outstanding, nested waiters included (their tasks are not done) */
+static int thread_pool_all_done(thread_pool_t *pool, void *ctx)
+{
+    (void)ctx;
+    return atomic_load(&(pool->outstanding)) == 0;
+}
+
+/* Inside a task: everything outstanding except the tasks waiting in thread_pool_wait, the caller's own included.
+ * Two tasks waiting at the same time cannot wait for each other
+ */
+static int thread_pool_all_done_nested(thread_pool_t *pool, void *ctx)
+{
+    (void)ctx;
+    return atomic_load(&(pool->outstanding)) <= atomic_load(&(pool->wait_nested));
+}
+
+/* Wait until every task submitted so far is done. The caller runs queued tasks meanwhile.
+ * Replaces polling thread_pool_completed with usleep
+ */
+int thread_pool_wait(thread_pool_t *pool)
+{
+    if (pool == NULL)
+        return -1;
+
+    /* Called from one of our tasks (on a worker, or on a thread helping us): that task is outstanding until
+       we return, do not wait for it */
+    int nested = (tls_worker != NULL && tls_worker->pool == pool) || tls_helped_pool == pool;
+    if (nested)
+        atomic_fetch_add(&(pool->wait_nested), 1);
+
+    int rc = thread_pool_help_until(pool, nested ? thread_pool_all_done_nested : thread_pool_all_done, NULL);
+
+    if (nested)
+        atomic_fetch_sub(&(pool->wait_nested), 1);
+    return rc;
+}
+
+void thread_pool_group_init(thread_pool_group_t *group, thread_pool_t *pool)
+{
+    group->pool = pool;
+    atomic_init(&(group->pending), 0);
+}
+
+/* Ring slot of a group task: copied inline, no allocation */
+typedef struct
+{
+    thread_pool_group_t *group;
+    void (*function)(void *);
+    void *argument;
+} thread_pool_group_task_t;
+
+static void thread_pool_group_run(void *arg)
+{
+    thread_pool_group_task_t *gt = (thread_pool_group_task_t *)arg;
+    thread_pool_group_t *group = gt->group;
+
+    thread_pool_call_profiled(group->pool, gt->function, gt->argument);
+
+    /* Waiters are woken when the task is charged (or right after, for caller-runs) */
+    atomic_fetch_sub(&(group->pending), 1);
+}
+
+/* Same, slot from thread_pool_arg_alloc (built with INLINE_ARG_SIZE too small for the group task) */
+static void thread_pool_group_run_alloc(void *arg)
+{
+    thread_pool_group_task_t gt = *(thread_pool_group_task_t *)arg;
+    thread_pool_arg_free(arg);
+    thread_pool_group_run(&gt);
+}
+
+int thread_pool_group_add(thread_pool_group_t *group, void (*function)(void *), void *argument)
+{
+    if (group == NULL || group->pool == NULL || function == NULL)
+        return -1;
+
+    thread_pool_group_task_t gt = {group, function, argument};
+    int rc;
+
+    atomic_fetch_add(&(group->pending), 1);
+    if (sizeof(gt) <= THREAD_POOL_INLINE_ARG_SIZE)
+    {
+        rc = thread_pool_push(group->pool, 0, thread_pool_group_run, NULL, &gt, sizeof(gt), 1, THREAD_TASK_INTERNAL);
+    }
+    else
+    {
+        thread_pool_group_task_t *copy = thread_pool_arg_alloc(group->pool, sizeof(gt));
+        rc = -1;
+        if (copy != NULL)
+        {
+            *copy = gt;
+            rc = thread_pool_push(group->pool, 0, thread_pool_group_run_alloc, copy, NULL, 0, 1, THREAD_TASK_INTERNAL);
+            if (rc != 0)
+                thread_pool_arg_free(copy);
+        }
+    }
+
+    if (rc != 0)
+        atomic_fetch_sub(&(group->pending), 1); // Rejected: not part of the group
+    return rc;
+}
+
+static int thread_pool_group_done(thread_pool_t *pool, void *ctx)
+{
+    (void)pool;
+    return atomic_load(&(((thread_pool_group_t *)ctx)->pending)) == 0;
+}
+
+/* Wait for the tasks of this group only, running queued tasks (of any group) meanwhile.
+ * Safe inside a task: the waiting worker keeps working, so nested waits cannot deadlock a small pool
+ */
+int thread_pool_group_wait(thread_pool_group_t *group)
+{
+    if (group == NULL || group->pool == NULL)
+        return -1;
+    return thread_pool_help_until(group->pool, thread_pool_group_done, group);
+}
+
+/* Submit one task and wait for it (helping meanwhile) */
+int thread_pool_add_wait(thread_pool_t *pool, void (*function)(void *), void *argument)
+{
+    thread_pool_group_t group;
+
+    thread_pool_group_init(&group, pool);
+    if (thread_pool_group_add(&group, function, argument) != 0)
+        return -1;
+    return thread_pool_group_wait(&group);
+}
+
+/* The current task is about to sleep (read, lock, sleep...): while it does, its CPU can run another worker.
+ * Start or unpark a spare (up to attr.max_spares); it parks again after thread_pool_end_blocking.
+ * Outside a worker this does nothing (-1). Sections may nest, only the outer one counts
+ */
+int thread_pool_begin_blocking(void)
+{
+    thread_pool_worker_t *self = tls_worker;
+    if (self == NULL)
+        return -1;
+    if (self->blocking++ > 0)
+        return 0;
+
+    thread_pool_t *pool = self->pool;
+    pthread_mutex_lock(&(pool->lock));
+    pool->blocked++;
+
+    /* A sleeping task does not use a CPU: it must not count against cpu_limit */
+    if (self->cpu_counted)
+        atomic_fetch_sub(&(pool->running), 1);
+
+    int target = pool->blocked < pool->attr.max_spares ? pool->blocked : pool->attr.max_spares;
+    if (pool->spares_active < target && pool->shutdown == 0)
+    {
+        if (pool->spares_parked > pool->spare_tokens)
+        {
+            /* Reuse a parked spare: no thread creation */
+            pool->spare_tokens++;
+            pool->spares_active++;
+            pthread_cond_signal(&(pool->spare_cond));
+        }
+        else if (pool->spares_started < pool->attr.max_spares &&
+                 thread_pool_start_worker(pool, pool->thread_count + pool->spares_started) == 0)
+        {
+            pool->spares_active++;
+        }
+    }
+
+    pthread_cond_signal(&(pool->notify)); // A worker parked on cpu_limit may go now
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+int thread_pool_end_blocking(void)
+{
+    thread_pool_worker_t *self = tls_worker;
+    if (self == NULL || self->blocking == 0)
+        return -1;
+    if (--self->blocking > 0)
+        return 0;
+
+    thread_pool_t *pool = self->pool;
+    pthread_mutex_lock(&(pool->lock));
+    pool->blocked--;
+    if (self->cpu_counted)
+        atomic_fetch_add(&(pool->running), 1);
+
+    /* Idle spares sleep on notify: wake them so the extra ones park */
+    if (thread_pool_spare_surplus(pool) && pool->idle > 0)
+        pthread_cond_broadcast(&(pool->notify));
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+int thread_pool_get_class_stats(thread_pool_t *pool, int class_id, thread_pool_class_stats_t *stats)
+{
+    if (pool == NULL || stats == NULL)
+        return -1;
+
+    pthread_mutex_lock(&(pool->lock));
+    if (class_id < 0 || class_id >= pool->class_count)
+    {
+        pthread_mutex_unlock(&(pool->lock));
+        return -1;
+    }
+
+    thread_pool_class_t *c = &(pool->classes[class_id]);
+    stats->name = c->name;
+    stats->weight = c->weight;
+    stats->queued = c->count;
+    stats->running = c->running;
+    stats->completed = c->completed;
+    stats->min_workers = c->min_workers;
+    stats->max_workers = c->max_workers;
+    stats->wait_avg_ns = c->timed > 0 ? (double)c->wait_ns_total / c->timed : 0;
+    stats->wait_max_ns = c->wait_ns_max;
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+/* Tasks finished so far (sum of the per-worker slots) */
+long thread_pool_completed(thread_pool_t *pool)
+{
+    if (pool == NULL)
+        return -1;
+    return sharded_counter_read(&(pool->task_completed));
+}
+
+/* Snapshot without pool->lock: relaxed loads of per-worker slots and of the queue mirrors.
+ * Values of different workers are not from the same instant (good enough for monitoring)
+ */
+int thread_pool_get_stats(thread_pool_t *pool, thread_pool_stats_t *stats)
+{
+    if (pool == NULL || stats == NULL || (stats->workers == NULL && stats->workers_capacity > 0))
+        return -1;
+
+    long now = (long)tp_clock_ns();
+    int slots = pool->thread_count + pool->attr.max_spares;
+    int n = 0;
+
+    for (int i = 0; i < slots && n < stats->workers_capacity; i++)
+    {
+        thread_pool_worker_counters_t *c = &(pool->workers[i].stats);
+        long start = atomic_load_explicit(&(c->start_ns), memory_order_acquire);
+        if (start == 0)
+            continue; // Not started (lazy_start, spare not needed yet)
+
+        thread_pool_worker_stats_t *w = &(stats->workers[n++]);
+        w->id = i;
+        w->spare = i >= pool->thread_count;
+        w->tasks = atomic_load_explicit(&(c->tasks), memory_order_relaxed);
+        w->parks = atomic_load_explicit(&(c->parks), memory_order_relaxed);
+        w->wakeups = atomic_load_explicit(&(c->wakeups), memory_order_relaxed);
+        w->helped = atomic_load_explicit(&(c->helped), memory_order_relaxed);
+
+        /* Idle now: the open period counts too. Busy is whatever is left of the lifetime */
+        long since = atomic_load_explicit(&(c->idle_since), memory_order_relaxed);
+        w->idle_ns = atomic_load_explicit(&(c->idle_ns), memory_order_relaxed) + (since != 0 ? now - since : 0);
+        w->busy_ns = now - start - w->idle_ns;
+        if (w->busy_ns < 0)
+            w->busy_ns = 0;
+
+        /* The kernel reads the counters of another thread for us (one syscall) */
+        tp_perf_read(&(pool->workers[i].perf), w->perf);
+    }
+
+    for (int e = 0; e < TP_PERF_EVENTS; e++)
+        stats->perf_names[e] = pool->perf_enabled && pool->perf_config.available[e] ? pool->perf_config.name[e] : NULL;
+
+    stats->worker_count = n;
+    stats->queue_depth = atomic_load_explicit(&(pool->queue_depth), memory_order_relaxed);
+    stats->queue_high_water = atomic_load_explicit(&(pool->queue_high_water), memory_order_relaxed);
+    stats->rejected = atomic_load_explicit(&(pool->overflow_rejected), memory_order_relaxed);
+    stats->completed = sharded_counter_read(&(pool->task_completed));
+
+    return 0;
+}
+
+/* Most CPU time first (count when CPU time is not measured) */
+static int thread_pool_func_cmp(const void *a, const void *b)
+{
+    const thread_pool_func_stats_t *x = a, *y = b;
+    if (x->cpu_ns_total != y->cpu_ns_total)
+        return (x->cpu_ns_total < y->cpu_ns_total) - (x->cpu_ns_total > y->cpu_ns_total);
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/* Per task function totals of all workers, busiest first. Return the number of entries written (at most max).
+ * Lock-free. Filled only with attr.profile_functions or attr.perf_counters
+ */
+int thread_pool_get_func_stats(thread_pool_t *pool, thread_pool_func_stats_t *out, int max)
+{
+    if (pool == NULL || (out == NULL && max > 0))
+        return -1;
+
+    int n = 0;
+    int slots = pool->thread_count + pool->attr.max_spares;
+    for (int i = 0; i < slots; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[i]);
+        if (atomic_load_explicit(&(w->stats.start_ns), memory_order_acquire) == 0 || w->funcs == NULL)
+            continue;
+
+        for (int k = 0; k < THREAD_POOL_FUNC_SLOTS; k++)
+        {
+            thread_pool_func_slot_t *slot = &(w->funcs[k]);
+            void *fn = atomic_load_explicit(&(slot->function), memory_order_acquire);
+            if (fn == NULL)
+                continue;
+
+            /* Same function on several workers: one entry */
+            int j = 0;
+            while (j < n && (void *)out[j].function != fn)
+                j++;
+            if (j == n)
+            {
+                if (n == max)
+                    continue;
+                out[n].function = (void (*)(void *))fn;
+                out[n].count = 0;
+                out[n].run_ns_total = 0;
+                out[n].run_ns_max = 0;
+                out[n].cpu_ns_total = 0;
+                for (int e = 0; e < TP_PERF_EVENTS; e++)
+                    out[n].perf[e] = 0;
+                n++;
+            }
+
+            out[j].count += atomic_load_explicit(&(slot->count), memory_order_relaxed);
+            out[j].run_ns_total += atomic_load_explicit(&(slot->run_ns), memory_order_relaxed);
+            out[j].cpu_ns_total += atomic_load_explicit(&(slot->cpu_ns), memory_order_relaxed);
+            long max_ns = atomic_load_explicit(&(slot->run_ns_max), memory_order_relaxed);
+            if (max_ns > out[j].run_ns_max)
+                out[j].run_ns_max = max_ns;
+            for (int e = 0; e < TP_PERF_EVENTS; e++)
+                out[j].perf[e] += (uint64_t)atomic_load_explicit(&(slot->perf[e]), memory_order_relaxed);
+        }
+    }
+
+    qsort(out, n, sizeof(thread_pool_func_stats_t), thread_pool_func_cmp);
+    return n;
+}
+
+/* Stack samples of all workers as folded stacks (flamegraph.pl, speedscope): "pool;task;frames... count".
+ * Lock-free, workers keep running. -1 if the sampler is off (attr.sample_hz = 0)
+ */
+int thread_pool_profile_dump(thread_pool_t *pool, const char *path)
+{
+    if (pool == NULL || path == NULL || pool->attr.sample_hz <= 0)
+        return -1;
+
+    int slots = pool->thread_count + pool->attr.max_spares;
+    tp_sampler_t **samplers = calloc(slots, sizeof(tp_sampler_t *));
+    const char **roots = calloc(slots, sizeof(const char *));
+    if (samplers == NULL || roots == NULL)
+    {
+        free(samplers);
+        free(roots);
+        return -1;
+    }
+
+    /* One root for all workers: the graph shows where the pool spends CPU, not which worker did */
+    const char *root = pool->attr.name != NULL ? pool->attr.name : "thread_pool";
+    int n = 0;
+    for (int i = 0; i < slots; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[i]);
+        if (atomic_load_explicit(&(w->stats.start_ns), memory_order_acquire) == 0 || w->sampler.samples == NULL)
+            continue;
+        samplers[n] = &(w->sampler);
+        roots[n] = root;
+        n++;
+    }
+
+    int rc = -1;
+    FILE *fp = fopen(path, "w");
+    if (fp != NULL)
+    {
+        rc = tp_sampler_write_folded(fp, samplers, roots, n) < 0 ? -1 : 0;
+        if (fclose(fp) != 0)
+            rc = -1;
+    }
+
+    free(samplers);
+    free(roots);
+    return rc;
+}
+
+/* "Top tasks": the top busiest task functions with their symbol names (dladdr, link with -rdynamic) */
+int thread_pool_func_report(thread_pool_t *pool, FILE *out, int top)
+{
+    if (pool == NULL || out == NULL || top <= 0)
+        return -1;
+
+    thread_pool_func_stats_t *funcs = malloc(sizeof(thread_pool_func_stats_t) * top);
+    if (funcs == NULL)
+        return -1;
+
+    int n = thread_pool_get_func_stats(pool, funcs, top);
+    fprintf(out, "%-28s %10s %10s %9s %9s %10s\n", "function", "count", "total ms", "avg us", "max us", "cpu ms");
+    for (int i = 0; i < n; i++)
+    {
+        char name[64];
+        tp_symbol_name((void *)funcs[i].function, name, sizeof(name));
+        fprintf(out, "%-28s %10ld %10.2f %9.2f %9.2f %10.2f\n", name, funcs[i].count, funcs[i].run_ns_total / 1e6,
+                funcs[i].run_ns_total / 1e3 / funcs[i].count, funcs[i].run_ns_max / 1e3, funcs[i].cpu_ns_total / 1e6);
+
+        /* Counters per task, when attr.perf_counters is on */
+        if (!pool->perf_enabled)
+            continue;
+        fprintf(out, "    per task:");
+        for (int e = 0; e < TP_PERF_EVENTS; e++)
+        {
+            if (pool->perf_config.available[e])
+                fprintf(out, " %s %.1f", pool->perf_config.name[e], (double)funcs[i].perf[e] / funcs[i].count);
+        }
+        fprintf(out, "\n");
+    }
+
+    free(funcs);
+    return n;
+}
+
+/* Queue-wait and run-time histograms of all workers merged into wait / run (either may be NULL).
+ * Lock-free like thread_pool_get_stats. Tasks run by non-worker threads (helping, caller-runs) are not in them
+ */
+int thread_pool_get_latency(thread_pool_t *pool, tp_histogram_t *wait, tp_histogram_t *run)
+{
+    if (pool == NULL)
+        return -1;
+
+#if THREAD_POOL_TIMESTAMPS
+    if (wait != NULL)
+        tp_histogram_reset(wait);
+    if (run != NULL)
+        tp_histogram_reset(run);
+
+    int slots = pool->thread_count + pool->attr.max_spares;
+    for (int i = 0; i < slots; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[i]);
+        if (atomic_load_explicit(&(w->stats.start_ns), memory_order_acquire) == 0 || w->hist == NULL)
+            continue;
+        if (wait != NULL)
+            tp_histogram_merge(wait, &(w->hist[0]));
+        if (run != NULL)
+            tp_histogram_merge(run, &(w->hist[1]));
+    }
+    return 0;
+#else
+    (void)wait;
+    (void)run;
+    return -1;
+#endif
+}
+
+/* Contention profile of one lock site: counters into stats, histograms merged into wait / hold (either may be NULL).
+ * Lock-free. -1 unless built with LOCKPROF=1
+ */
+int thread_pool_get_lock_stats(thread_pool_t *pool, thread_pool_lock_site_t site, thread_pool_lock_stats_t *stats,
+                               tp_histogram_t *wait, tp_histogram_t *hold)
+{
+    static const char *names[THREAD_POOL_LOCK_SITES] = {"add", "dequeue", "help", "destroy", "broadcast"};
+
+    if (pool == NULL || stats == NULL || site < 0 || site >= THREAD_POOL_LOCK_SITES)
+        return -1;
+
+    stats->site = names[site];
+#if THREAD_POOL_LOCKPROF
+    thread_pool_lock_prof_t *prof = &(pool->lock_prof[site]);
+    stats->acquired = atomic_load_explicit(&(prof->acquired), memory_order_relaxed);
+    stats->contended = atomic_load_explicit(&(prof->contended), memory_order_relaxed);
+    if (wait != NULL)
+        tp_histogram_merge(wait, &(prof->wait));
+    if (hold != NULL)
+        tp_histogram_merge(hold, &(prof->hold));
+    return 0;
+#else
+    (void)wait;
+    (void)hold;
+    stats->acquired = 0;
+    stats->contended = 0;
+    return -1;
+#endif
+}
+
+/* Write the recent task timeline of every worker as Chrome trace-event JSON
+ * (open in chrome://tracing or https://ui.perfetto.dev): one row per worker, one box per task.
+ * Lock-free, workers keep running. -1 if tracing is off (attr.trace_capacity = 0 or TIMESTAMPS=0)
+ */
+int thread_pool_trace_dump(thread_pool_t *pool, const char *path)
+{
+#if THREAD_POOL_TIMESTAMPS
+    if (pool == NULL || path == NULL || pool->attr.trace_capacity == 0)
+        return -1;
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL)
+        return -1;
+
+    unsigned long max = pool->attr.trace_capacity;
+    tp_trace_record_t *records = malloc(sizeof(tp_trace_record_t) * max);
+    if (records == NULL)
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    int first = 1;
+    tp_trace_write_header(fp);
+
+    int slots = pool->thread_count + pool->attr.max_spares;
+    for (int i = 0; i < slots; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[i]);
+        if (atomic_load_explicit(&(w->stats.start_ns), memory_order_acquire) == 0 || w->trace.events == NULL)
+            continue;
+
+        /* Row name: worker and its core, so the timeline reads per core */
+        char name[64];
+        snprintf(name, sizeof(name), "%s %d (cpu %d)", i < pool->thread_count ? "worker" : "spare", i, w->cpu);
+        tp_trace_write_thread(fp, &first, i, name);
+
+        unsigned long n = tp_trace_ring_snapshot(&(w->trace), records, max);
+        for (unsigned long k = 0; k < n; k++)
+            tp_trace_write_event(fp, &first, i, &records[k], pool->trace_base);
+    }
+
+    tp_trace_write_footer(fp);
+    free(records);
+    return fclose(fp) == 0 ? 0 : -1;
+#else
+    (void)pool;
+    (void)path;
+    return -1;
+#endif
+}
+
+/* O(1), no syscall in steady state: blocks come back to the allocating thread's slab */
+void *thread_pool_arg_alloc(thread_pool_t *pool, size_t size)
+{
+    if (pool == NULL)
+        return NULL;
+    return arg_slab_alloc(&(pool->arg_slab), size);
+}
+
+/* Callable from any thread (usually the worker at the end of the task) */
+void thread_pool_arg_free(void *ptr)
+{
+    arg_slab_free(ptr);
+}
+
+/* Bump allocation from the arena of the current worker, no free needed */
+void *thread_pool_scratch_alloc(size_t size)
+{
+    if (tls_worker == NULL)
+        return NULL;
+    return scratch_arena_alloc(&(tls_worker->scratch), size);
+}
+
+/* Context of the worker running the current task (NULL outside a worker of this pool) */
+void *thread_pool_worker_local(thread_pool_t *pool)
+{
+    if (tls_worker == NULL || tls_worker->pool != pool)
+        return NULL;
+    return tls_worker->local;
+}
+
+/* Run fn(arg) exactly once on every worker and wait for all of them.
+ * Example: flush per-worker caches, or fold worker-local counters into a total.
+ * Called from inside a task, the calling worker runs its own part first (no self-deadlock). A worker waiting
+ * for its turn, or waiting in thread_pool_wait / thread_pool_group_wait, runs the broadcast in flight meanwhile
+ */
+int thread_pool_broadcast(thread_pool_t *pool, void (*fn)(void *), void *arg)
+{
+    if (pool == NULL || fn == NULL)
+        return -1;
+
+    /* 1. One broadcast at a time. A worker waiting here is still counted by the one in flight: run it */
+    POOL_LOCK(pool, BROADCAST);
+    while (pool->bcast_busy && pool->shutdown == 0)
+    {
+        if (thread_pool_broadcast_due(pool))
+        {
+            thread_pool_run_broadcast(pool, tls_worker, THREAD_POOL_LOCK_BROADCAST);
+            continue;
+        }
+        POOL_HOLD_END(pool, BROADCAST);
+        pthread_cond_wait(&(pool->bcast_done), &(pool->lock));
+        POOL_HOLD_BEGIN();
+    }
+
+    if (pool->shutdown)
+    {
+        POOL_UNLOCK(pool, BROADCAST);
+        return -1;
+    }
+    pool->bcast_busy = 1;
+
+    /* 2. lazy_start: "every worker" means every worker, start the missing ones (after a start in flight) */
+    while (pool->lazy_starting)
+    {
+        POOL_HOLD_END(pool, BROADCAST);
+        pthread_cond_wait(&(pool->bcast_done), &(pool->lock));
+        POOL_HOLD_BEGIN();
+    }
+    while (pool->started < pool->thread_count)
+    {
+        if (thread_pool_start_worker(pool, pool->started) != 0)
+            break;
+    }
+
+    /* 3. Publish */
+    pool->bcast_fn = fn;
+    pool->bcast_arg = arg;
+    pool->bcast_seq++;
+    pool->bcast_pending = pool->started + pool->spares_started;
+    pthread_cond_broadcast(&(pool->notify));
+    pthread_cond_broadcast(&(pool->spare_cond));
+    pthread_cond_broadcast(&(pool->done_cond)); // Workers inside thread_pool_wait
+    pthread_cond_broadcast(&(pool->bcast_done)); // Workers waiting for their own broadcast
+
+    /* 4. Caller is one of our workers: it cannot pick the broadcast from the loop, run it here */
+    if (tls_worker != NULL && tls_worker->pool == pool)
+        thread_pool_run_broadcast(pool, tls_worker, THREAD_POOL_LOCK_BROADCAST);
+
+    /* 5. Wait for the others */
+    while (pool->bcast_pending > 0)
+    {
+        POOL_HOLD_END(pool, BROADCAST);
+        pthread_cond_wait(&(pool->bcast_done), &(pool->lock));
+        POOL_HOLD_BEGIN();
+    }
+
+    pool->bcast_busy = 0;
+    pthread_cond_broadcast(&(pool->bcast_done)); // Next broadcaster
+    POOL_UNLOCK(pool, BROADCAST);
+
+    return 0;
+}
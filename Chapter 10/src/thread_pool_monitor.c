@@ -0,0 +1,442 @@
+#define _GNU_SOURCE // open_memstream, pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "thread_pool.h"
+
+/*  Metrics endpoint: one thread per pool, asleep in poll() until
+    - a client connects to the Unix socket: it gets the snapshot (plain text, or HTTP if it sent "GET ...")
+    - SIGUSR1 arrives: the handler only writes one byte to a pipe (self-pipe trick), the monitor thread
+      that drains it writes the snapshot of every live monitored pool to stderr
+    The snapshot is built from the lock-free readers only (stats, latency, lock profile): a scrape never
+    takes pool->lock, the workers do not notice it
+*/
+typedef struct thread_pool_monitor
+{
+    pthread_t thread;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    int stop_pipe[2]; // destroy -> monitor thread
+    thread_pool_t *pool;
+    struct thread_pool_monitor *next; // Registry of live monitors (tp_monitor_signal_lock)
+} thread_pool_monitor_t;
+
+/*  SIGUSR1 is process-wide, the monitors share it:
+    the first one registered installs the handler, the last one unregistered restores the old action
+*/
+static volatile sig_atomic_t tp_monitor_signal_fd = -1; // Write end of the SIGUSR1 pipe, -1: none
+static int tp_monitor_signal_pipe[2] = {-1, -1};
+static pthread_mutex_t tp_monitor_signal_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_pool_monitor_t *tp_monitor_list; // Live monitors
+static struct sigaction tp_monitor_old_usr1;   // Action before the first monitor
+
+static void thread_pool_monitor_on_signal(int sig)
+{
+    (void)sig;
+    int saved_errno = errno;
+    int fd = tp_monitor_signal_fd;
+    if (fd >= 0)
+    {
+        char c = 1;
+        ssize_t rc = write(fd, &c, 1); // Non-blocking: a full pipe already has a dump pending
+        (void)rc;
+    }
+    errno = saved_errno;
+}
+
+/* Prometheus histogram in seconds, le = powers of 2 from 1 us to 16 s (exact: they are bucket edges) */
+static void thread_pool_metrics_histogram(FILE *out, const char *name, const char *help, const char *labels,
+                                          const tp_histogram_t *h)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+    long cumulative = 0;
+    int next = 0;
+    for (int k = 10; k <= 34; k++)
+    {
+        uint64_t le_ns = (uint64_t)1 << k;
+        int last = tp_histogram_index(le_ns - 1);
+        for (; next <= last; next++)
+            cumulative += atomic_load_explicit(&(h->buckets[next]), memory_order_relaxed);
+        fprintf(out, "%s_bucket{%s,le=\"%g\"} %ld\n", name, labels, le_ns / 1e9, cumulative);
+    }
+    for (; next < TP_HIST_BUCKETS; next++)
+        cumulative += atomic_load_explicit(&(h->buckets[next]), memory_order_relaxed);
+
+    /* Count from the buckets: +Inf must match _count even while workers write */
+    fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %ld\n", name, labels, cumulative);
+    fprintf(out, "%s_sum{%s} %.9f\n", name, labels, atomic_load_explicit(&(h->sum_ns), memory_order_relaxed) / 1e9);
+    fprintf(out, "%s_count{%s} %ld\n", name, labels, cumulative);
+}
+
+static const char *thread_pool_worker_state(const thread_pool_worker_t *w)
+{
+    if (atomic_load_explicit(&(w->stats.current_task), memory_order_acquire) != NULL)
+        return "running";
+    if (atomic_load_explicit(&(w->stats.parked), memory_order_relaxed))
+        return "parked";
+    if (atomic_load_explicit(&(w->stats.idle_since), memory_order_relaxed) != 0)
+        return "idle";
+    return "scheduling"; // Between tasks: taking the lock, picking a class, bookkeeping
+}
+
+int thread_pool_metrics_write(thread_pool_t *pool, FILE *out)
+{
+    if (pool == NULL || out == NULL)
+        return -1;
+
+    int slots = pool->thread_count + pool->attr.max_spares;
+    thread_pool_worker_stats_t *workers = malloc(sizeof(thread_pool_worker_stats_t) * slots);
+    tp_histogram_t *hist = malloc(sizeof(tp_histogram_t) * 2); // ~9 KB each: not on the monitor stack
+    if (workers == NULL || hist == NULL)
+    {
+        free(workers);
+        free(hist);
+        return -1;
+    }
+
+    thread_pool_stats_t stats = {.workers = workers, .workers_capacity = slots};
+    thread_pool_overflow_stats_t overflow;
+    thread_pool_get_stats(pool, &stats);
+    thread_pool_get_overflow_stats(pool, &overflow);
+
+    char labels[64];
+    snprintf(labels, sizeof(labels), "pool=\"%s\"", pool->attr.name != NULL ? pool->attr.name : "default");
+
+    /* 1. Pool */
+    fprintf(out, "# HELP thread_pool_queue_depth Tasks queued now (all classes)\n# TYPE thread_pool_queue_depth gauge\n");
+    fprintf(out, "thread_pool_queue_depth{%s} %d\n", labels, stats.queue_depth);
+    fprintf(out, "# HELP thread_pool_queue_high_water Largest queue depth seen\n# TYPE thread_pool_queue_high_water gauge\n");
+    fprintf(out, "thread_pool_queue_high_water{%s} %d\n", labels, stats.queue_high_water);
+    fprintf(out, "# HELP thread_pool_tasks_completed_total Tasks finished\n# TYPE thread_pool_tasks_completed_total counter\n");
+    fprintf(out, "thread_pool_tasks_completed_total{%s} %ld\n", labels, stats.completed);
+    fprintf(out, "# HELP thread_pool_overflow_total Submissions that found the ring full, by policy outcome\n");
+    fprintf(out, "# TYPE thread_pool_overflow_total counter\n");
+    fprintf(out, "thread_pool_overflow_total{%s,outcome=\"rejected\"} %ld\n", labels, overflow.rejected);
+    fprintf(out, "thread_pool_overflow_total{%s,outcome=\"caller_runs\"} %ld\n", labels, overflow.caller_runs);
+    fprintf(out, "thread_pool_overflow_total{%s,outcome=\"blocked\"} %ld\n", labels, overflow.blocked);
+    fprintf(out, "thread_pool_overflow_total{%s,outcome=\"dropped\"} %ld\n", labels, overflow.dropped);
+    fprintf(out, "# HELP thread_pool_slow_tasks_total Tasks the watchdog reported over budget\n");
+    fprintf(out, "# TYPE thread_pool_slow_tasks_total counter\n");
+    fprintf(out, "thread_pool_slow_tasks_total{%s} %ld\n", labels,
+            atomic_load_explicit(&(pool->slow_tasks), memory_order_relaxed));
+
+    /* 2. Workers: state as a one-hot gauge, the task running now and for how long */
+    static const char *states[] = {"running", "idle", "parked", "scheduling"};
+    fprintf(out, "# HELP thread_pool_worker_state 1 for the current state of the worker\n# TYPE thread_pool_worker_state gauge\n");
+    for (int i = 0; i < stats.worker_count; i++)
+    {
+        const char *now = thread_pool_worker_state(&(pool->workers[workers[i].id]));
+        for (int s = 0; s < 4; s++)
+            fprintf(out, "thread_pool_worker_state{%s,worker=\"%d\",state=\"%s\"} %d\n", labels, workers[i].id, states[s],
+                    strcmp(now, states[s]) == 0);
+    }
+
+    uint64_t now_ticks = tp_clock_ticks();
+    fprintf(out, "# HELP thread_pool_worker_task_seconds How long the current task has been running\n");
+    fprintf(out, "# TYPE thread_pool_worker_task_seconds gauge\n");
+    for (int i = 0; i < stats.worker_count; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[workers[i].id]);
+        void *task = atomic_load_explicit(&(w->stats.current_task), memory_order_acquire);
+        uint64_t start = atomic_load_explicit(&(w->stats.current_start), memory_order_relaxed);
+        if (task == NULL || start == 0)
+            continue;
+
+        char name[128];
+        tp_symbol_name(task, name, sizeof(name));
+        double elapsed = tp_clock_elapsed_ns(start, now_ticks) / 1e9;
+        fprintf(out, "thread_pool_worker_task_seconds{%s,worker=\"%d\",task=\"%s\"} %.6f\n", labels, workers[i].id, name,
+                elapsed);
+    }
+
+    static const char *counters[][2] = {
+        {"tasks", "Tasks executed"},
+        {"busy_seconds", "Time alive and not idle"},
+        {"idle_seconds", "Time waiting for work or parked"},
+        {"parks", "Times the worker went to sleep"},
+        {"wakeups", "Times the worker woke up"},
+        {"helped", "Tasks run while waiting inside a task"},
+    };
+    for (int c = 0; c < 6; c++)
+    {
+        fprintf(out, "# HELP thread_pool_worker_%s_total %s\n# TYPE thread_pool_worker_%s_total counter\n",
+                counters[c][0], counters[c][1], counters[c][0]);
+        for (int i = 0; i < stats.worker_count; i++)
+        {
+            thread_pool_worker_stats_t *w = &workers[i];
+            double v = c == 0 ? w->tasks : c == 1 ? w->busy_ns / 1e9 : c == 2 ? w->idle_ns / 1e9
+                     : c == 3 ? w->parks : c == 4 ? w->wakeups : w->helped;
+            fprintf(out, "thread_pool_worker_%s_total{%s,worker=\"%d\"} %.9g\n", counters[c][0], labels, w->id, v);
+        }
+    }
+
+    /* 3. Latency histograms (TIMESTAMPS=1) */
+    tp_histogram_reset(&hist[0]);
+    tp_histogram_reset(&hist[1]);
+    if (thread_pool_get_latency(pool, &hist[0], &hist[1]) == 0)
+    {
+        thread_pool_metrics_histogram(out, "thread_pool_queue_wait_seconds", "Submit to start of a task", labels, &hist[0]);
+        thread_pool_metrics_histogram(out, "thread_pool_task_run_seconds", "Start to end of a task", labels, &hist[1]);
+    }
+
+    /* 4. Lock profile (LOCKPROF=1) */
+    thread_pool_lock_stats_t lock;
+    if (thread_pool_get_lock_stats(pool, THREAD_POOL_LOCK_ADD, &lock, NULL, NULL) == 0)
+    {
+        fprintf(out, "# HELP thread_pool_lock_acquired_total pool->lock acquisitions by site\n");
+        fprintf(out, "# TYPE thread_pool_lock_acquired_total counter\n");
+        for (int s = 0; s < THREAD_POOL_LOCK_SITES; s++)
+        {
+            thread_pool_get_lock_stats(pool, s, &lock, NULL, NULL);
+            fprintf(out, "thread_pool_lock_acquired_total{%s,site=\"%s\"} %ld\n", labels, lock.site, lock.acquired);
+        }
+        fprintf(out, "# HELP thread_pool_lock_contended_total Acquisitions that had to wait\n");
+        fprintf(out, "# TYPE thread_pool_lock_contended_total counter\n");
+        for (int s = 0; s < THREAD_POOL_LOCK_SITES; s++)
+        {
+            thread_pool_get_lock_stats(pool, s, &lock, NULL, NULL);
+            fprintf(out, "thread_pool_lock_contended_total{%s,site=\"%s\"} %ld\n", labels, lock.site, lock.contended);
+        }
+    }
+
+    free(workers);
+    free(hist);
+    return ferror(out) ? -1 : 0;
+}
+
+/* Write all of buf (the client may read slowly) */
+static void thread_pool_monitor_send(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL); // Client gone: EPIPE, not SIGPIPE
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void thread_pool_monitor_serve(thread_pool_t *pool, int client)
+{
+    /* A request is optional (socat / nc just read). Wait briefly for "GET ": then answer as HTTP (curl --unix-socket) */
+    char request[512];
+    ssize_t got = 0;
+    struct pollfd pfd = {.fd = client, .events = POLLIN};
+    if (poll(&pfd, 1, 100) > 0)
+        got = recv(client, request, sizeof(request) - 1, 0);
+    int http = got >= 4 && memcmp(request, "GET ", 4) == 0;
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *mem = open_memstream(&body, &body_len);
+    if (mem == NULL)
+        return;
+    thread_pool_metrics_write(pool, mem);
+    fclose(mem);
+
+    if (http)
+    {
+        char header[160];
+        int n = snprintf(header, sizeof(header),
+                         "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                         body_len);
+        thread_pool_monitor_send(client, header, (size_t)n);
+    }
+    thread_pool_monitor_send(client, body, body_len);
+    free(body);
+}
+
+/* Add mon to the registry, the first one takes SIGUSR1. -1 if the pipe cannot be created */
+static int thread_pool_monitor_register(thread_pool_monitor_t *mon)
+{
+    pthread_mutex_lock(&tp_monitor_signal_lock);
+    if (tp_monitor_signal_pipe[0] < 0 && pipe2(tp_monitor_signal_pipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        pthread_mutex_unlock(&tp_monitor_signal_lock);
+        return -1;
+    }
+    if (tp_monitor_list == NULL)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = thread_pool_monitor_on_signal;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&(sa.sa_mask));
+        sigaction(SIGUSR1, &sa, &tp_monitor_old_usr1);
+        tp_monitor_signal_fd = tp_monitor_signal_pipe[1];
+    }
+    mon->next = tp_monitor_list;
+    tp_monitor_list = mon;
+    pthread_mutex_unlock(&tp_monitor_signal_lock);
+    return 0;
+}
+
+/* Remove mon from the registry, the last one gives SIGUSR1 back (the pipe stays: a signal may be in flight) */
+static void thread_pool_monitor_unregister(thread_pool_monitor_t *mon)
+{
+    pthread_mutex_lock(&tp_monitor_signal_lock);
+    thread_pool_monitor_t **link = &tp_monitor_list;
+    while (*link != NULL && *link != mon)
+        link = &((*link)->next);
+    if (*link == mon)
+        *link = mon->next;
+    if (tp_monitor_list == NULL)
+    {
+        sigaction(SIGUSR1, &tp_monitor_old_usr1, NULL);
+        tp_monitor_signal_fd = -1;
+    }
+    pthread_mutex_unlock(&tp_monitor_signal_lock);
+}
+
+/* SIGUSR1 drained: one dump of every registered pool. The lock keeps them registered, and
+   thread_pool_monitor_stop unregisters before the pool goes away */
+static void thread_pool_monitor_dump_all(void)
+{
+    pthread_mutex_lock(&tp_monitor_signal_lock);
+    for (thread_pool_monitor_t *m = tp_monitor_list; m != NULL; m = m->next)
+        thread_pool_metrics_write(m->pool, stderr);
+    fflush(stderr);
+    pthread_mutex_unlock(&tp_monitor_signal_lock);
+}
+
+static void *thread_pool_monitor_main(void *arg)
+{
+    thread_pool_t *pool = arg;
+    thread_pool_monitor_t *mon = pool->monitor;
+
+    while (1)
+    {
+        struct pollfd fds[3] = {
+            {.fd = mon->stop_pipe[0], .events = POLLIN},
+            {.fd = mon->listen_fd, .events = POLLIN},
+            {.fd = tp_monitor_signal_pipe[0], .events = POLLIN},
+        };
+        if (poll(fds, 3, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        /* 1. destroy: leave before the workers go away */
+        if (fds[0].revents != 0)
+            break;
+
+        /* 2. Scrape */
+        if (fds[1].revents & POLLIN)
+        {
+            int client = accept4(mon->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client >= 0)
+            {
+                thread_pool_monitor_serve(pool, client);
+                close(client);
+            }
+        }
+
+        /* 3. SIGUSR1: every monitor wakes up, the one that drains the pipe dumps (several signals, one dump) */
+        if (fds[2].revents & POLLIN)
+        {
+            char drain[64];
+            int got = 0;
+            while (read(tp_monitor_signal_pipe[0], drain, sizeof(drain)) > 0)
+                got = 1;
+            if (got)
+                thread_pool_monitor_dump_all();
+        }
+    }
+
+    return NULL;
+}
+
+int thread_pool_monitor_start(thread_pool_t *pool, const char *path)
+{
+    if (pool == NULL || path == NULL || pool->monitor != NULL)
+        return -1;
+
+    thread_pool_monitor_t *mon = calloc(1, sizeof(thread_pool_monitor_t));
+    if (mon == NULL)
+        return -1;
+    if (strlen(path) >= sizeof(mon->path))
+    {
+        free(mon);
+        return -1; // sun_path is ~108 bytes
+    }
+    snprintf(mon->path, sizeof(mon->path), "%s", path);
+    mon->pool = pool;
+    mon->listen_fd = -1;
+    mon->stop_pipe[0] = mon->stop_pipe[1] = -1;
+
+    /* 1. Socket: a stale file of a previous run is replaced */
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, mon->path, strlen(mon->path) + 1);
+    unlink(mon->path);
+
+    mon->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mon->listen_fd < 0 || bind(mon->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(mon->listen_fd, 8) != 0 || pipe2(mon->stop_pipe, O_CLOEXEC) != 0)
+        goto err;
+
+    /* 2. SIGUSR1 -> self-pipe (created once, shared by all monitors) */
+    if (thread_pool_monitor_register(mon) != 0)
+        goto err;
+
+    /* 3. Thread: signals go to other threads when possible (it only polls) */
+    pool->monitor = mon;
+    if (pthread_create(&(mon->thread), NULL, thread_pool_monitor_main, pool) != 0)
+    {
+        pool->monitor = NULL;
+        thread_pool_monitor_unregister(mon);
+        goto err;
+    }
+    pthread_setname_np(mon->thread, "pool-monitor");
+    return 0;
+
+err:
+    if (mon->listen_fd >= 0)
+    {
+        close(mon->listen_fd);
+        unlink(mon->path);
+    }
+    if (mon->stop_pipe[0] >= 0)
+    {
+        close(mon->stop_pipe[0]);
+        close(mon->stop_pipe[1]);
+    }
+    free(mon);
+    return -1;
+}
+
+void thread_pool_monitor_stop(thread_pool_t *pool)
+{
+    if (pool == NULL || pool->monitor == NULL)
+        return;
+
+    thread_pool_monitor_t *mon = pool->monitor;
+
+    /* Out of the SIGUSR1 dumps before the pool goes away */
+    thread_pool_monitor_unregister(mon);
+
+    char c = 1;
+    ssize_t rc = write(mon->stop_pipe[1], &c, 1);
+    (void)rc;
+    pthread_join(mon->thread, NULL);
+
+    close(mon->listen_fd);
+    unlink(mon->path);
+    close(mon->stop_pipe[0]);
+    close(mon->stop_pipe[1]);
+    free(mon);
+    pool->monitor = NULL;
+}
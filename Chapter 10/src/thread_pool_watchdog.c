@@ -0,0 +1,203 @@
+#define _GNU_SOURCE // pipe2
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+/*  Slow / stuck task watchdog: one thread per pool, wakes up 4 times per budget
+    - Reads the task every worker publishes (current_task, current_start): lock-free, like the monitor
+    - A task over budget is reported once, then again each time its run time doubles (stuck: 1x, 2x, 4x ...)
+    - attr.watchdog_stacks: the first report adds a stack of the worker (tp_sampler_capture). Only the first:
+      each capture is a SIGPROF that cuts the task's nanosleep / poll / epoll_wait short (EINTR)
+*/
+typedef struct
+{
+    uint64_t start;      // current_start of the task last looked at
+    uint64_t next_ns;    // Report when its run time reaches this
+} thread_pool_watchdog_slot_t;
+
+typedef struct thread_pool_watchdog
+{
+    pthread_t thread;
+    int stop_pipe[2]; // destroy -> watchdog thread
+    int slot_count;
+    thread_pool_watchdog_slot_t *slots;
+} thread_pool_watchdog_t;
+
+/* CPU the thread last ran on (field 39 of /proc/self/task/<tid>/stat), -1: unknown */
+static int thread_pool_watchdog_last_cpu(int tid)
+{
+    char path[64], line[1024];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    char *ok = fgets(line, sizeof(line), fp);
+    fclose(fp);
+
+    /* The name (field 2) may contain spaces: count from the closing parenthesis, which ends field 2 */
+    char *p = ok != NULL ? strrchr(line, ')') : NULL;
+    for (int field = 2; p != NULL && field < 39; field++)
+        p = strchr(p + 1, ' ');
+    return p != NULL ? atoi(p + 1) : -1;
+}
+
+static void thread_pool_watchdog_report(thread_pool_t *pool, thread_pool_worker_t *w, void *task, uint64_t start,
+                                        uint64_t elapsed_ns, int first)
+{
+    char name[128];
+    tp_sampler_symbol_name(task, name, sizeof(name)); // .symtab too: most task functions are static
+
+    /* One fprintf per line, stack included in a single buffer: reports of two pools do not interleave */
+    char *text = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&text, &len);
+    if (out == NULL)
+        return;
+
+    fprintf(out, "[Watchdog] %s: worker %d (CPU %d, pinned %d) %s %s for %.1f ms (budget %d ms)\n",
+            pool->attr.name != NULL ? pool->attr.name : "pool", w->id, thread_pool_watchdog_last_cpu(w->tid), w->cpu,
+            first ? "has been running" : "still running", name, elapsed_ns / 1e6, pool->attr.watchdog_budget_ms);
+
+    if (pool->attr.watchdog_stacks && first)
+    {
+        void *pcs[TP_SAMPLER_DEPTH];
+        int depth = tp_sampler_capture(w->tid, pcs, TP_SAMPLER_DEPTH, 100);
+
+        /* The sample is taken after the scan: keep it only if the same task still runs */
+        int same = atomic_load_explicit(&(w->stats.current_start), memory_order_acquire) == start &&
+                   atomic_load_explicit(&(w->stats.current_task), memory_order_relaxed) == task;
+        if (depth >= 0 && same)
+            tp_sampler_write_stack(out, "    ", pcs, depth);
+        else if (depth >= 0)
+            fprintf(out, "    (no stack: the task finished before the sample)\n");
+        else
+            fprintf(out, "    (no stack: the worker did not answer)\n");
+    }
+
+    fclose(out);
+    fputs(text, stderr);
+    free(text);
+}
+
+static void thread_pool_watchdog_scan(thread_pool_t *pool, thread_pool_watchdog_t *dog)
+{
+    uint64_t budget_ns = (uint64_t)pool->attr.watchdog_budget_ms * 1000000;
+
+    for (int i = 0; i < dog->slot_count; i++)
+    {
+        thread_pool_worker_t *w = &(pool->workers[i]);
+        thread_pool_watchdog_slot_t *slot = &(dog->slots[i]);
+
+        /* Slot not started yet (lazy_start, spares): nothing published */
+        if (atomic_load_explicit(&(w->stats.start_ns), memory_order_acquire) == 0)
+            continue;
+
+        /* Task, start, task again: a task that ended between the reads (its start may already be the
+         * outer one of a nested run) is skipped, it will be looked at on the next scan
+         */
+        void *task = atomic_load_explicit(&(w->stats.current_task), memory_order_acquire);
+        uint64_t start = atomic_load_explicit(&(w->stats.current_start), memory_order_acquire);
+        if (task == NULL || start == 0 || atomic_load_explicit(&(w->stats.current_task), memory_order_relaxed) != task)
+            continue;
+
+        /* 1. Another task since the last scan: start over with one budget */
+        if (start != slot->start)
+        {
+            slot->start = start;
+            slot->next_ns = budget_ns;
+        }
+
+        uint64_t now = tp_clock_ticks();
+        uint64_t elapsed = tp_clock_elapsed_ns(start, now);
+        if (elapsed < slot->next_ns)
+            continue;
+
+        /* 2. Over budget: report, next report when the run time has doubled */
+        int first = slot->next_ns == budget_ns;
+        if (first)
+            atomic_fetch_add_explicit(&(pool->slow_tasks), 1, memory_order_relaxed);
+        thread_pool_watchdog_report(pool, w, task, start, elapsed, first);
+        while (slot->next_ns <= elapsed)
+            slot->next_ns *= 2;
+    }
+}
+
+static void *thread_pool_watchdog_main(void *arg)
+{
+    thread_pool_t *pool = arg;
+    thread_pool_watchdog_t *dog = pool->watchdog;
+
+    /* 4 scans per budget: a task is reported at most budget / 4 late. At least 1 ms, at most 1 s */
+    int period_ms = pool->attr.watchdog_budget_ms / 4;
+    if (period_ms < 1)
+        period_ms = 1;
+    if (period_ms > 1000)
+        period_ms = 1000;
+
+    while (1)
+    {
+        struct pollfd pfd = {.fd = dog->stop_pipe[0], .events = POLLIN};
+        int rc = poll(&pfd, 1, period_ms);
+        if (rc < 0 && errno != EINTR)
+            break;
+        if (rc > 0)
+            break; // destroy
+
+        thread_pool_watchdog_scan(pool, dog);
+    }
+
+    return NULL;
+}
+
+int thread_pool_watchdog_start(thread_pool_t *pool)
+{
+    if (pool == NULL || pool->attr.watchdog_budget_ms <= 0 || pool->watchdog != NULL)
+        return -1;
+
+    thread_pool_watchdog_t *dog = calloc(1, sizeof(thread_pool_watchdog_t));
+    if (dog == NULL)
+        return -1;
+    dog->slot_count = pool->thread_count + pool->attr.max_spares;
+    dog->slots = calloc(dog->slot_count, sizeof(thread_pool_watchdog_slot_t));
+    if (dog->slots == NULL || pipe2(dog->stop_pipe, O_CLOEXEC) != 0)
+    {
+        free(dog->slots);
+        free(dog);
+        return -1;
+    }
+
+    pool->watchdog = dog;
+    if (pthread_create(&(dog->thread), NULL, thread_pool_watchdog_main, pool) != 0)
+    {
+        pool->watchdog = NULL;
+        close(dog->stop_pipe[0]);
+        close(dog->stop_pipe[1]);
+        free(dog->slots);
+        free(dog);
+        return -1;
+    }
+    pthread_setname_np(dog->thread, "pool-watchdog");
+    return 0;
+}
+
+void thread_pool_watchdog_stop(thread_pool_t *pool)
+{
+    if (pool == NULL || pool->watchdog == NULL)
+        return;
+
+    thread_pool_watchdog_t *dog = pool->watchdog;
+    char c = 1;
+    ssize_t rc = write(dog->stop_pipe[1], &c, 1);
+    (void)rc;
+    pthread_join(dog->thread, NULL);
+
+    close(dog->stop_pipe[0]);
+    close(dog->stop_pipe[1]);
+    free(dog->slots);
+    free(dog);
+    pool->watchdog = NULL;
+}
@@ -0,0 +1,44 @@
+#include <pthread.h>
+#include "tp_clock.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+int tp_clock_use_tsc = 0;
+double tp_clock_ns_per_tick = 1.0;
+
+static pthread_once_t tp_clock_once = PTHREAD_ONCE_INIT;
+
+#define TP_CLOCK_CALIBRATE_NS 2000000 // 2 ms against CLOCK_MONOTONIC: error well below 0.1%
+
+static void tp_clock_calibrate(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    /* 1. Invariant TSC: CPUID 0x80000007, EDX bit 8. Without it the rate changes with frequency / C-states */
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 8)) == 0)
+        return;
+
+    /* 2. Ticks per ns over a short busy window */
+    uint64_t ns0 = tp_clock_ns();
+    uint64_t t0 = __rdtsc();
+    uint64_t ns1;
+    do
+    {
+        ns1 = tp_clock_ns();
+    } while (ns1 - ns0 < TP_CLOCK_CALIBRATE_NS);
+    uint64_t t1 = __rdtsc();
+
+    if (t1 <= t0)
+        return;
+
+    tp_clock_ns_per_tick = (double)(ns1 - ns0) / (double)(t1 - t0);
+    tp_clock_use_tsc = 1;
+#endif
+}
+
+void tp_clock_init(void)
+{
+    pthread_once(&tp_clock_once, tp_clock_calibrate);
+}
@@ -0,0 +1,94 @@
+#include <string.h>
+#include "tp_histogram.h"
+
+/* Counter with a single writer: plain load + store */
+static inline void hist_add(atomic_long *v, long delta)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + delta, memory_order_relaxed);
+}
+
+void tp_histogram_reset(tp_histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*  0 .. 2*SUB-1: one bucket per value
+    2^e .. 2^(e+1)-1 (e > SUB_BITS): SUB buckets of width 2^(e-SUB_BITS)
+*/
+int tp_histogram_index(uint64_t ns)
+{
+    if (ns < 2 * TP_HIST_SUB)
+        return (int)ns;
+
+    int e = 63 - __builtin_clzll(ns); // Position of the leading bit, > SUB_BITS here
+    if (e >= TP_HIST_MAX_BITS)
+        return TP_HIST_BUCKETS - 1;
+
+    int shift = e - TP_HIST_SUB_BITS;
+    int sub = (int)(ns >> shift) - TP_HIST_SUB; // Next SUB_BITS bits after the leading one
+    return 2 * TP_HIST_SUB + (e - TP_HIST_SUB_BITS - 1) * TP_HIST_SUB + sub;
+}
+
+uint64_t tp_histogram_bucket_upper(int index)
+{
+    if (index < 2 * TP_HIST_SUB)
+        return (uint64_t)index;
+
+    int e = (index - 2 * TP_HIST_SUB) / TP_HIST_SUB + TP_HIST_SUB_BITS + 1;
+    int sub = (index - 2 * TP_HIST_SUB) % TP_HIST_SUB;
+    int shift = e - TP_HIST_SUB_BITS;
+    return (((uint64_t)(TP_HIST_SUB + sub) + 1) << shift) - 1;
+}
+
+void tp_histogram_record(tp_histogram_t *h, uint64_t ns)
+{
+    hist_add(&(h->buckets[tp_histogram_index(ns)]), 1);
+    hist_add(&(h->count), 1);
+    hist_add(&(h->sum_ns), (long)ns);
+    if ((long)ns > atomic_load_explicit(&(h->max_ns), memory_order_relaxed))
+        atomic_store_explicit(&(h->max_ns), (long)ns, memory_order_relaxed);
+}
+
+void tp_histogram_merge(tp_histogram_t *dst, const tp_histogram_t *src)
+{
+    /* Count is summed from the buckets: consistent with them even while src is being written */
+    long count = 0;
+    for (int i = 0; i < TP_HIST_BUCKETS; i++)
+    {
+        long n = atomic_load_explicit(&(src->buckets[i]), memory_order_relaxed);
+        if (n != 0)
+        {
+            hist_add(&(dst->buckets[i]), n);
+            count += n;
+        }
+    }
+    hist_add(&(dst->count), count);
+    hist_add(&(dst->sum_ns), atomic_load_explicit(&(src->sum_ns), memory_order_relaxed));
+
+    long max = atomic_load_explicit(&(src->max_ns), memory_order_relaxed);
+    if (max > atomic_load_explicit(&(dst->max_ns), memory_order_relaxed))
+        atomic_store_explicit(&(dst->max_ns), max, memory_order_relaxed);
+}
+
+uint64_t tp_histogram_percentile(const tp_histogram_t *h, double p)
+{
+    long count = atomic_load_explicit(&(h->count), memory_order_relaxed);
+    if (count <= 0)
+        return 0;
+
+    /* Rank of the value we look for (1-based), p = 100 is the max */
+    long rank = (long)((p / 100.0) * (double)count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank >= count)
+        return (uint64_t)atomic_load_explicit(&(h->max_ns), memory_order_relaxed);
+
+    long seen = 0;
+    for (int i = 0; i < TP_HIST_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&(h->buckets[i]), memory_order_relaxed);
+        if (seen >= rank)
+            return tp_histogram_bucket_upper(i);
+    }
+    return (uint64_t)atomic_load_explicit(&(h->max_ns), memory_order_relaxed);
+}
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE // syscall()
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "tp_perf.h"
+
+typedef struct
+{
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} tp_perf_event_t;
+
+static const tp_perf_event_t tp_perf_hw[TP_PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+};
+
+static const tp_perf_event_t tp_perf_sw[TP_PERF_EVENTS] = {
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+};
+
+static int tp_perf_event_open(uint32_t type, uint64_t config, int exclude_kernel, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+
+    /* pid 0, cpu -1: this thread, wherever it runs */
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Try kernel + user first (context switches happen in the kernel), then user only
+ * (perf_event_paranoid >= 2 refuses kernel counting to unprivileged users)
+ */
+static int tp_perf_try(const tp_perf_event_t *ev, int group_fd, int *exclude_kernel)
+{
+    for (int exk = 0; exk <= 1; exk++)
+    {
+        int fd = tp_perf_event_open(ev->type, ev->config, exk, group_fd);
+        if (fd >= 0)
+        {
+            *exclude_kernel = exk;
+            return fd;
+        }
+        if (errno != EACCES && errno != EPERM)
+            return -1;
+    }
+    return -1;
+}
+
+int tp_perf_probe(tp_perf_config_t *config)
+{
+    if (config == NULL)
+        return -1;
+
+    memset(config, 0, sizeof(*config));
+
+    /* 1. The PMU decides for the whole set: mixing "cycles" of one worker with "task-clock" of another is useless */
+    int exk;
+    int fd = tp_perf_try(&tp_perf_hw[0], -1, &exk);
+    config->hardware = fd >= 0;
+    if (fd >= 0)
+        close(fd);
+
+    /* 2. Then every slot on its own: a PMU may lack one event (Ex: no cache-misses in some VMs) */
+    const tp_perf_event_t *set = config->hardware ? tp_perf_hw : tp_perf_sw;
+    int any = 0;
+    for (int i = 0; i < TP_PERF_EVENTS; i++)
+    {
+        const tp_perf_event_t *ev = &set[i];
+        fd = tp_perf_try(ev, -1, &exk);
+        if (fd < 0 && config->hardware)
+        {
+            ev = &tp_perf_sw[i];
+            fd = tp_perf_try(ev, -1, &exk);
+        }
+        if (fd < 0)
+            continue;
+
+        close(fd);
+        config->type[i] = ev->type;
+        config->config[i] = ev->config;
+        config->exclude_kernel[i] = exk;
+        config->name[i] = ev->name;
+        config->available[i] = 1;
+        any = 1;
+    }
+
+    return any ? 0 : -1;
+}
+
+int tp_perf_open(tp_perf_t *perf, const tp_perf_config_t *config)
+{
+    if (perf == NULL || config == NULL)
+        return -1;
+
+    perf->count = 0;
+    for (int i = 0; i < TP_PERF_EVENTS; i++)
+    {
+        if (!config->available[i])
+            continue;
+
+        int group = perf->count > 0 ? perf->fd[0] : -1;
+        int fd = tp_perf_event_open(config->type[i], config->config[i], config->exclude_kernel[i], group);
+        if (fd < 0)
+            continue; // Group full (PMU out of counters): go on without this one
+
+        perf->fd[perf->count] = fd;
+        perf->slot[perf->count] = i;
+        perf->count++;
+    }
+
+    return perf->count > 0 ? 0 : -1;
+}
+
+int tp_perf_read(const tp_perf_t *perf, uint64_t values[TP_PERF_EVENTS])
+{
+    /* PERF_FORMAT_GROUP: { nr, value[nr] } in the order the events joined */
+    uint64_t buf[1 + TP_PERF_EVENTS];
+
+    for (int i = 0; i < TP_PERF_EVENTS; i++)
+        values[i] = 0;
+
+    if (perf == NULL || perf->count == 0)
+        return -1;
+    if (read(perf->fd[0], buf, sizeof(buf)) < (ssize_t)sizeof(uint64_t))
+        return -1;
+
+    for (uint64_t i = 0; i < buf[0] && i < (uint64_t)perf->count; i++)
+        values[perf->slot[i]] = buf[1 + i];
+    return 0;
+}
+
+void tp_perf_close(tp_perf_t *perf)
+{
+    if (perf == NULL)
+        return;
+
+    /* Members first, the leader last */
+    for (int i = perf->count - 1; i >= 0; i--)
+        close(perf->fd[i]);
+    perf->count = 0;
+}
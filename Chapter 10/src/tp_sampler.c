@@ -0,0 +1,551 @@
+#define _GNU_SOURCE // gettid, sigev_notify_thread_id, dladdr
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <stdint.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "tp_sampler.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid // Named only since glibc 2.41
+#endif
+
+/* Sampler of the current thread, read by the signal handler */
+static __thread tp_sampler_t *tls_sampler;
+
+static pthread_once_t tp_sampler_once = PTHREAD_ONCE_INIT;
+static int tp_sampler_installed;
+
+/* One-shot capture (tp_sampler_capture), one at a time for the whole process
+ * state: 0 free, 1 requested (tid set), 2 handler copying, 3 done
+ */
+static struct
+{
+    pthread_mutex_t lock;
+    atomic_int state;
+    int tid;
+    int depth;
+    void *pcs[TP_SAMPLER_DEPTH];
+} tp_capture = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+/* Runs on the sampled thread: only async-signal-safe work, no lock, no malloc */
+static void tp_sampler_handler(int sig, siginfo_t *info, void *ucontext)
+{
+    (void)sig;
+    (void)ucontext;
+
+    int saved_errno = errno;
+
+    /* 1. Asked for by tp_sampler_capture (tgkill: not a timer tick, not a ring sample) */
+    if (info->si_code == SI_TKILL)
+    {
+        int expected = 1;
+        if (atomic_load_explicit(&(tp_capture.state), memory_order_acquire) == 1 && tp_capture.tid == gettid() &&
+            atomic_compare_exchange_strong_explicit(&(tp_capture.state), &expected, 2, memory_order_acquire,
+                                                    memory_order_relaxed))
+        {
+            void *pcs[TP_SAMPLER_DEPTH + TP_SAMPLER_SKIP];
+            int depth = backtrace(pcs, TP_SAMPLER_DEPTH + TP_SAMPLER_SKIP) - TP_SAMPLER_SKIP;
+            tp_capture.depth = depth < 0 ? 0 : depth;
+            for (int i = 0; i < tp_capture.depth; i++)
+                tp_capture.pcs[i] = pcs[TP_SAMPLER_SKIP + i];
+            atomic_store_explicit(&(tp_capture.state), 3, memory_order_release);
+        }
+        errno = saved_errno;
+        return;
+    }
+
+    /* 2. Timer tick of this thread's sampler */
+    tp_sampler_t *s = tls_sampler;
+    if (s == NULL || s->samples == NULL)
+    {
+        errno = saved_errno;
+        return;
+    }
+
+    void *pcs[TP_SAMPLER_DEPTH + TP_SAMPLER_SKIP];
+    int depth = backtrace(pcs, TP_SAMPLER_DEPTH + TP_SAMPLER_SKIP) - TP_SAMPLER_SKIP;
+    if (depth < 0)
+        depth = 0;
+
+    unsigned long head = atomic_load_explicit(&(s->head), memory_order_relaxed);
+    tp_sample_t *slot = &(s->samples[head & s->mask]);
+    atomic_store_explicit(&(slot->seq), 2 * head + 1, memory_order_relaxed); // Odd: being written
+    atomic_thread_fence(memory_order_release);                               // Odd seq visible before the sample
+    atomic_store_explicit(&(slot->task), atomic_load_explicit(s->current_task, memory_order_relaxed),
+                          memory_order_relaxed);
+    atomic_store_explicit(&(slot->depth), depth, memory_order_relaxed);
+    for (int i = 0; i < depth; i++)
+        atomic_store_explicit(&(slot->pcs[i]), pcs[TP_SAMPLER_SKIP + i], memory_order_relaxed);
+    atomic_store_explicit(&(slot->seq), 2 * head + 2, memory_order_release);
+    atomic_store_explicit(&(s->head), head + 1, memory_order_release);
+
+    errno = saved_errno;
+}
+
+static void tp_sampler_install(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = tp_sampler_handler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART; // Interrupted read() / write() of the task restart
+    sigemptyset(&(sa.sa_mask));
+    tp_sampler_installed = sigaction(SIGPROF, &sa, NULL) == 0;
+}
+
+int tp_sampler_start(tp_sampler_t *sampler, int hz, unsigned long capacity, _Atomic(void *) *current_task)
+{
+    if (sampler == NULL || hz <= 0 || capacity == 0 || current_task == NULL)
+        return -1;
+
+    unsigned long cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    sampler->samples = calloc(cap, sizeof(tp_sample_t));
+    if (sampler->samples == NULL)
+        return -1;
+    sampler->mask = cap - 1;
+    sampler->current_task = current_task;
+    sampler->armed = 0;
+    atomic_init(&(sampler->head), 0);
+
+    /* backtrace() loads libgcc on its first call (malloc, locks): do it here, not in the handler */
+    void *warmup[2];
+    backtrace(warmup, 2);
+
+    pthread_once(&tp_sampler_once, tp_sampler_install);
+    if (!tp_sampler_installed)
+        return -1;
+    tls_sampler = sampler;
+
+    /* 1. Timer on the CPU time of this thread, signal delivered to this thread */
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = gettid();
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &(sampler->timer)) != 0)
+        return -1;
+
+    /* 2. Period 1/hz, first sample after one period */
+    struct itimerspec its;
+    its.it_interval.tv_sec = 0;
+    its.it_interval.tv_nsec = 1000000000L / hz;
+    if (hz == 1)
+    {
+        its.it_interval.tv_sec = 1;
+        its.it_interval.tv_nsec = 0;
+    }
+    its.it_value = its.it_interval;
+    if (timer_settime(sampler->timer, 0, &its, NULL) != 0)
+    {
+        timer_delete(sampler->timer);
+        return -1;
+    }
+
+    sampler->armed = 1;
+    return 0;
+}
+
+void tp_sampler_stop(tp_sampler_t *sampler)
+{
+    if (sampler == NULL || !sampler->armed)
+        return;
+
+    timer_delete(sampler->timer); // A signal already pending still finds the ring
+    sampler->armed = 0;
+}
+
+void tp_sampler_destroy(tp_sampler_t *sampler)
+{
+    if (sampler == NULL)
+        return;
+
+    free(sampler->samples);
+    sampler->samples = NULL;
+}
+
+int tp_sampler_capture(int tid, void **pcs, int max, int timeout_ms)
+{
+    if (tid <= 0 || pcs == NULL || max <= 0)
+        return -1;
+
+    /* backtrace() loads libgcc on its first call: in this thread, not in the handler of the target */
+    void *warmup[2];
+    backtrace(warmup, 2);
+    pthread_once(&tp_sampler_once, tp_sampler_install);
+    if (!tp_sampler_installed)
+        return -1;
+
+    pthread_mutex_lock(&(tp_capture.lock));
+    tp_capture.tid = tid;
+    atomic_store_explicit(&(tp_capture.state), 1, memory_order_release);
+
+    /* 1. Ask, then wait for the answer (polled: the handler cannot signal a condition variable) */
+    int depth = -1;
+    if (syscall(SYS_tgkill, getpid(), tid, SIGPROF) == 0)
+    {
+        struct timespec tick = {0, 200000}; // 0.2 ms
+        for (int waited = 0; waited < timeout_ms * 5; waited++)
+        {
+            if (atomic_load_explicit(&(tp_capture.state), memory_order_acquire) == 3)
+                break;
+            nanosleep(&tick, NULL);
+        }
+    }
+
+    /* 2. No answer: withdraw. A handler that already started copying (2) is waited for */
+    int expected = 1;
+    if (!atomic_compare_exchange_strong_explicit(&(tp_capture.state), &expected, 0, memory_order_relaxed,
+                                                 memory_order_relaxed))
+    {
+        while (atomic_load_explicit(&(tp_capture.state), memory_order_acquire) != 3)
+            sched_yield();
+        depth = tp_capture.depth < max ? tp_capture.depth : max;
+        for (int i = 0; i < depth; i++)
+            pcs[i] = tp_capture.pcs[i];
+        atomic_store_explicit(&(tp_capture.state), 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&(tp_capture.lock));
+    return depth;
+}
+
+/*  dladdr only knows exported symbols: static functions (the worker loop, most task functions)
+    are only in the .symtab of the file. Load it once per dump for every module we meet
+*/
+#define TP_SAMPLER_MODULES 16
+
+typedef struct
+{
+    uintptr_t start;
+    uintptr_t size;
+    const char *name; // Inside module->strtab
+} tp_elf_sym_t;
+
+typedef struct
+{
+    void *base;      // dli_fbase
+    int relative;    // ET_DYN (PIE, .so): symbol values are offsets from base
+    char *data;      // Whole file
+    tp_elf_sym_t *syms;
+    size_t count;
+} tp_elf_module_t;
+
+typedef struct
+{
+    tp_elf_module_t modules[TP_SAMPLER_MODULES];
+    int count;
+} tp_elf_cache_t;
+
+static int tp_elf_sym_cmp(const void *a, const void *b)
+{
+    const tp_elf_sym_t *x = a, *y = b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Function symbols of .symtab (64-bit ELF). A stripped file just has none */
+static void tp_elf_load(tp_elf_module_t *m, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return;
+
+    long size = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        size = ftell(fp);
+    if (size < (long)sizeof(Elf64_Ehdr) || fseek(fp, 0, SEEK_SET) != 0 || (m->data = malloc(size)) == NULL ||
+        fread(m->data, 1, size, fp) != (size_t)size)
+    {
+        fclose(fp);
+        return;
+    }
+    fclose(fp);
+
+    Elf64_Ehdr *eh = (Elf64_Ehdr *)m->data;
+    if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > (uint64_t)size)
+        return;
+    m->relative = eh->e_type == ET_DYN;
+
+    Elf64_Shdr *sh = (Elf64_Shdr *)(m->data + eh->e_shoff);
+    for (int i = 0; i < eh->e_shnum; i++)
+    {
+        if (sh[i].sh_type != SHT_SYMTAB || sh[i].sh_link >= eh->e_shnum)
+            continue;
+
+        Elf64_Shdr *str = &sh[sh[i].sh_link];
+        if (sh[i].sh_offset + sh[i].sh_size > (uint64_t)size || str->sh_offset + str->sh_size > (uint64_t)size)
+            return;
+
+        Elf64_Sym *sym = (Elf64_Sym *)(m->data + sh[i].sh_offset);
+        size_t n = sh[i].sh_size / sizeof(Elf64_Sym);
+        m->syms = malloc(sizeof(tp_elf_sym_t) * (n > 0 ? n : 1));
+        if (m->syms == NULL)
+            return;
+
+        for (size_t k = 0; k < n; k++)
+        {
+            if (ELF64_ST_TYPE(sym[k].st_info) != STT_FUNC || sym[k].st_value == 0 || sym[k].st_name >= str->sh_size)
+                continue;
+            m->syms[m->count].start = sym[k].st_value;
+            m->syms[m->count].size = sym[k].st_size;
+            m->syms[m->count].name = m->data + str->sh_offset + sym[k].st_name;
+            m->count++;
+        }
+        qsort(m->syms, m->count, sizeof(tp_elf_sym_t), tp_elf_sym_cmp);
+        return;
+    }
+}
+
+static const char *tp_elf_lookup(tp_elf_cache_t *cache, const Dl_info *info, void *pc)
+{
+    tp_elf_module_t *m = NULL;
+    for (int i = 0; i < cache->count; i++)
+    {
+        if (cache->modules[i].base == info->dli_fbase)
+            m = &(cache->modules[i]);
+    }
+    if (m == NULL)
+    {
+        if (cache->count == TP_SAMPLER_MODULES)
+            return NULL;
+        m = &(cache->modules[cache->count++]);
+        memset(m, 0, sizeof(*m));
+        m->base = info->dli_fbase;
+        tp_elf_load(m, info->dli_fname);
+    }
+
+    /* Last symbol starting at or below the address */
+    uintptr_t addr = m->relative ? (uintptr_t)pc - (uintptr_t)m->base : (uintptr_t)pc;
+    size_t lo = 0, hi = m->count;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m->syms[mid].start <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+
+    tp_elf_sym_t *sym = &(m->syms[lo - 1]);
+    return (sym->size == 0 || addr < sym->start + sym->size) ? sym->name : NULL;
+}
+
+static void tp_elf_cache_free(tp_elf_cache_t *cache)
+{
+    for (int i = 0; i < cache->count; i++)
+    {
+        free(cache->modules[i].syms);
+        free(cache->modules[i].data);
+    }
+    cache->count = 0;
+}
+
+/* Frame name for a flame graph: symbol, else [library], else address. Never contains ';' or ' ' */
+static void tp_sampler_frame_name(tp_elf_cache_t *cache, void *pc, char *buf, size_t size)
+{
+    Dl_info info;
+    int found = dladdr(pc, &info) != 0;
+    const char *name = NULL;
+
+    if (found && info.dli_sname == NULL && info.dli_fname != NULL)
+        name = tp_elf_lookup(cache, &info, pc);
+
+    if (found && info.dli_sname != NULL)
+    {
+        snprintf(buf, size, "%s", info.dli_sname);
+    }
+    else if (name != NULL)
+    {
+        snprintf(buf, size, "%s", name);
+    }
+    else if (found && info.dli_fname != NULL)
+    {
+        const char *base = strrchr(info.dli_fname, '/');
+        snprintf(buf, size, "[%s]", base != NULL ? base + 1 : info.dli_fname);
+    }
+    else
+    {
+        snprintf(buf, size, "%p", pc);
+    }
+}
+
+/* One folded line: root;task;outermost;...;innermost */
+static char *tp_sampler_fold(tp_elf_cache_t *cache, const char *root, void *task, int depth, void *const *pcs)
+{
+    size_t cap = 256, len = 0;
+    char *line = malloc(cap);
+    char name[256];
+    if (line == NULL)
+        return NULL;
+
+    len = (size_t)snprintf(line, cap, "%s", root);
+    for (int i = -1; i < depth; i++)
+    {
+        if (i < 0)
+        {
+            if (task == NULL)
+                snprintf(name, sizeof(name), "[pool]"); // Worker loop: lock, wait, bookkeeping
+            else
+                tp_sampler_frame_name(cache, task, name, sizeof(name));
+        }
+        else
+        {
+            /* Return addresses point after the call: step back into the caller (not for the interrupted pc) */
+            int f = depth - 1 - i;
+            tp_sampler_frame_name(cache, f == 0 ? pcs[f] : (char *)pcs[f] - 1, name, sizeof(name));
+        }
+
+        size_t need = len + strlen(name) + 2;
+        if (need > cap)
+        {
+            while (cap < need)
+                cap *= 2;
+            char *grown = realloc(line, cap);
+            if (grown == NULL)
+            {
+                free(line);
+                return NULL;
+            }
+            line = grown;
+        }
+        len += (size_t)sprintf(line + len, ";%s", name);
+    }
+    return line;
+}
+
+static int tp_sampler_cmp(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int tp_sampler_write_folded(FILE *fp, tp_sampler_t *const *samplers, const char *const *roots, int count)
+{
+    if (fp == NULL || (samplers == NULL && count > 0))
+        return -1;
+
+    /* 1. Upper bound of samples to fold */
+    size_t total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (samplers[i] == NULL || samplers[i]->samples == NULL)
+            continue;
+        unsigned long head = atomic_load_explicit(&(samplers[i]->head), memory_order_acquire);
+        total += head < samplers[i]->mask + 1 ? head : samplers[i]->mask + 1;
+    }
+
+    char **lines = malloc(sizeof(char *) * (total > 0 ? total : 1));
+    if (lines == NULL)
+        return -1;
+
+    /* 2. Copy and fold each sample. Slots the owner rewrote while we copied them are dropped (see seq) */
+    static tp_elf_cache_t empty;
+    tp_elf_cache_t *cache = malloc(sizeof(tp_elf_cache_t));
+    if (cache == NULL)
+    {
+        free(lines);
+        return -1;
+    }
+    *cache = empty;
+    size_t n = 0;
+    for (int i = 0; i < count; i++)
+    {
+        tp_sampler_t *s = samplers[i];
+        if (s == NULL || s->samples == NULL)
+            continue;
+
+        unsigned long capacity = s->mask + 1;
+        unsigned long head = atomic_load_explicit(&(s->head), memory_order_acquire);
+        unsigned long first = head > capacity ? head - capacity : 0;
+
+        for (unsigned long k = first; k < head && n < total; k++)
+        {
+            tp_sample_t *slot = &(s->samples[k & s->mask]);
+            void *pcs[TP_SAMPLER_DEPTH];
+            unsigned long seq = atomic_load_explicit(&(slot->seq), memory_order_acquire);
+            if (seq != 2 * k + 2)
+                continue; // Being written, or already a later lap
+            void *task = atomic_load_explicit(&(slot->task), memory_order_relaxed);
+            int depth = atomic_load_explicit(&(slot->depth), memory_order_relaxed);
+            if (depth > TP_SAMPLER_DEPTH)
+                depth = TP_SAMPLER_DEPTH;
+            for (int f = 0; f < depth; f++)
+                pcs[f] = atomic_load_explicit(&(slot->pcs[f]), memory_order_relaxed);
+
+            atomic_thread_fence(memory_order_acquire); // Sample read before seq is checked again
+            if (atomic_load_explicit(&(slot->seq), memory_order_relaxed) != seq)
+                continue; // Overwritten during the copy
+
+            char *line = tp_sampler_fold(cache, roots != NULL ? roots[i] : "thread", task, depth, pcs);
+            if (line != NULL)
+                lines[n++] = line;
+        }
+    }
+
+    /* 3. Equal stacks next to each other, then one line per distinct stack with its count */
+    qsort(lines, n, sizeof(char *), tp_sampler_cmp);
+    for (size_t i = 0; i < n;)
+    {
+        size_t j = i + 1;
+        while (j < n && strcmp(lines[i], lines[j]) == 0)
+            j++;
+        fprintf(fp, "%s %zu\n", lines[i], j - i);
+        i = j;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        free(lines[i]);
+    free(lines);
+    tp_elf_cache_free(cache);
+    free(cache);
+    return (int)n;
+}
+
+void tp_sampler_write_stack(FILE *fp, const char *indent, void *const *pcs, int depth)
+{
+    if (fp == NULL || pcs == NULL)
+        return;
+
+    static tp_elf_cache_t empty;
+    tp_elf_cache_t *cache = malloc(sizeof(tp_elf_cache_t));
+    if (cache == NULL)
+        return;
+    *cache = empty;
+
+    for (int i = 0; i < depth; i++)
+    {
+        char name[256];
+        tp_sampler_frame_name(cache, pcs[i], name, sizeof(name));
+        fprintf(fp, "%s#%-2d %s\n", indent != NULL ? indent : "", i, name);
+    }
+
+    tp_elf_cache_free(cache);
+    free(cache);
+}
+
+const char *tp_sampler_symbol_name(void *pc, char *buf, size_t size)
+{
+    static tp_elf_cache_t empty;
+    tp_elf_cache_t *cache = malloc(sizeof(tp_elf_cache_t));
+    if (cache == NULL)
+    {
+        snprintf(buf, size, "%p", pc);
+        return buf;
+    }
+    *cache = empty;
+    tp_sampler_frame_name(cache, pc, buf, size);
+    tp_elf_cache_free(cache);
+    free(cache);
+    return buf;
+}
@@ -0,0 +1,104 @@
+#define _GNU_SOURCE // dladdr
+#include <dlfcn.h>
+#include <stdlib.h>
+#include "tp_trace.h"
+#include "tp_clock.h"
+
+int tp_trace_ring_init(tp_trace_ring_t *ring, unsigned long capacity)
+{
+    unsigned long size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    ring->events = calloc(size, sizeof(tp_trace_event_t));
+    if (ring->events == NULL)
+        return -1;
+    ring->mask = size - 1;
+    atomic_init(&(ring->head), 0);
+    return 0;
+}
+
+void tp_trace_ring_destroy(tp_trace_ring_t *ring)
+{
+    free(ring->events);
+    ring->events = NULL;
+}
+
+unsigned long tp_trace_ring_snapshot(tp_trace_ring_t *ring, tp_trace_record_t *out, unsigned long max)
+{
+    if (ring->events == NULL)
+        return 0;
+
+    unsigned long capacity = ring->mask + 1;
+    unsigned long head = atomic_load_explicit(&(ring->head), memory_order_acquire);
+    unsigned long first = head > capacity ? head - capacity : 0;
+    if (head - first > max)
+        first = head - max;
+
+    /* Copy while the worker keeps writing: a slot rewritten meanwhile (torn, or already a later lap) is dropped */
+    unsigned long n = 0;
+    for (unsigned long i = first; i < head; i++)
+    {
+        tp_trace_event_t *e = &(ring->events[i & ring->mask]);
+        tp_trace_record_t *r = &(out[n]);
+        unsigned long seq = atomic_load_explicit(&(e->seq), memory_order_acquire);
+        if (seq != 2 * i + 2)
+            continue;
+        r->function = atomic_load_explicit(&(e->function), memory_order_relaxed);
+        r->enqueue_ts = atomic_load_explicit(&(e->enqueue_ts), memory_order_relaxed);
+        r->start_ts = atomic_load_explicit(&(e->start_ts), memory_order_relaxed);
+        r->end_ts = atomic_load_explicit(&(e->end_ts), memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire); // Fields read before seq is checked again
+        if (atomic_load_explicit(&(e->seq), memory_order_relaxed) == seq)
+            n++;
+    }
+    return n;
+}
+
+const char *tp_symbol_name(void *addr, char *buf, size_t size)
+{
+    Dl_info info;
+
+    if (dladdr(addr, &info) != 0 && info.dli_sname != NULL)
+        snprintf(buf, size, "%s", info.dli_sname);
+    else
+        snprintf(buf, size, "%p", addr);
+    return buf;
+}
+
+void tp_trace_write_header(FILE *fp)
+{
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+}
+
+static void tp_trace_sep(FILE *fp, int *first)
+{
+    if (!*first)
+        fprintf(fp, ",\n");
+    *first = 0;
+}
+
+/* Metadata event: name of a timeline row */
+void tp_trace_write_thread(FILE *fp, int *first, int tid, const char *name)
+{
+    tp_trace_sep(fp, first);
+    fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", tid, name);
+}
+
+/* Complete event ("X"): ts / dur in microseconds since base_ts, queue wait as argument */
+void tp_trace_write_event(FILE *fp, int *first, int tid, const tp_trace_record_t *rec, uint64_t base_ts)
+{
+    char name[128];
+    double ts = tp_clock_elapsed_ns(base_ts, rec->start_ts) / 1e3;
+    double dur = tp_clock_elapsed_ns(rec->start_ts, rec->end_ts) / 1e3;
+    double wait = tp_clock_elapsed_ns(rec->enqueue_ts, rec->start_ts) / 1e3;
+
+    tp_trace_sep(fp, first);
+    fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"wait_us\":%.3f}}",
+            tp_symbol_name(rec->function, name, sizeof(name)), tid, ts, dur, wait);
+}
+
+void tp_trace_write_footer(FILE *fp)
+{
+    fprintf(fp, "\n]}\n");
+}
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "thread_pool.h"
+
+/* Test: thread_pool_broadcast from inside tasks
+ * 1. Two tasks broadcast at the same time: the second one runs the first broadcast while it waits for its turn
+ * 2. A task broadcasts while another task sleeps in a nested thread_pool_wait: the waiter runs its part
+ */
+#define WORKERS 4
+#define ROUNDS 20
+
+static thread_pool_t *g_pool;
+static atomic_int g_hits, g_started;
+
+static void hit(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_hits, 1);
+}
+
+/* 1. Both broadcasters are running before either one starts */
+static void broadcaster(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_started, 1);
+    while (atomic_load(&g_started) < 2)
+        usleep(100);
+    thread_pool_broadcast(g_pool, hit, NULL);
+}
+
+/* 2. Keeps a nested waiter busy long enough for the broadcast to be published */
+static void slow(void *arg)
+{
+    (void)arg;
+    usleep(50 * 1000);
+}
+
+static void nested_waiter(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_started, 1);
+    thread_pool_add(g_pool, slow, NULL);
+    thread_pool_wait(g_pool);
+}
+
+static void late_broadcaster(void *arg)
+{
+    (void)arg;
+    while (atomic_load(&g_started) < 1)
+        usleep(100);
+    usleep(10 * 1000); // The waiter is asleep on the pool by now
+    thread_pool_broadcast(g_pool, hit, NULL);
+}
+
+int main(void)
+{
+    alarm(20); // A broadcast nobody services shows up as a hang: fail instead
+
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = WORKERS;
+    g_pool = thread_pool_create_attr(&attr);
+    if (g_pool == NULL)
+        return 1;
+
+    int failed = 0;
+    for (int round = 0; round < ROUNDS && !failed; round++)
+    {
+        atomic_store(&g_hits, 0);
+        atomic_store(&g_started, 0);
+        thread_pool_add(g_pool, broadcaster, NULL);
+        thread_pool_add(g_pool, broadcaster, NULL);
+        thread_pool_wait(g_pool);
+        if (atomic_load(&g_hits) != 2 * WORKERS)
+        {
+            fprintf(stderr, "concurrent: round %d, %d hits (want %d)\n", round, atomic_load(&g_hits), 2 * WORKERS);
+            failed = 1;
+        }
+    }
+
+    for (int round = 0; round < ROUNDS && !failed; round++)
+    {
+        atomic_store(&g_hits, 0);
+        atomic_store(&g_started, 0);
+        thread_pool_add(g_pool, nested_waiter, NULL);
+        thread_pool_add(g_pool, late_broadcaster, NULL);
+        thread_pool_wait(g_pool);
+        if (atomic_load(&g_hits) != WORKERS)
+        {
+            fprintf(stderr, "nested wait: round %d, %d hits (want %d)\n", round, atomic_load(&g_hits), WORKERS);
+            failed = 1;
+        }
+    }
+
+    thread_pool_destroy(g_pool);
+    fprintf(stderr, "test_broadcast: %s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
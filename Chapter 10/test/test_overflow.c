@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "thread_pool.h"
+
+/* Test: overflow policies around pool machinery
+ * 1. DROP_OLDEST never drops pool machinery. The only worker is held by a gate task while the ring fills
+ *    with strand runners, group wrappers and plain tasks. Only plain tasks may be dropped (and reach the
+ *    discard callback). Once the ring holds internal tasks only, submissions are rejected. After the gate
+ *    opens, every keyed and group task runs
+ * 2. A producer blocked by BLOCK applies the new policy when thread_pool_set_overflow_policy changes it
+ */
+#define RING 8
+#define KEYS 3
+#define TASKS_PER_KEY 5
+
+static atomic_int g_gate_open, g_gate_running;
+static atomic_int g_keyed_ran, g_group_ran, g_user_ran, g_discarded, g_bad_discards;
+
+static void gate_task(void *arg)
+{
+    (void)arg;
+    atomic_store(&g_gate_running, 1);
+    while (!atomic_load(&g_gate_open))
+        usleep(1000);
+}
+
+static void user_task(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_user_ran, 1);
+}
+
+static void keyed_task(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_keyed_ran, 1);
+}
+
+static void group_task(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_group_ran, 1);
+}
+
+static void discard(void (*function)(void *), void *argument)
+{
+    (void)argument;
+    atomic_fetch_add(&g_discarded, 1);
+    if (function != user_task)
+        atomic_fetch_add(&g_bad_discards, 1); // A strand runner or a group wrapper was dropped
+}
+
+static void *blocked_producer(void *arg)
+{
+    thread_pool_t *pool = arg;
+    return (void *)(long)thread_pool_add(pool, user_task, NULL);
+}
+
+/* 2. BLOCK -> REJECT releases the blocked producer with -2 */
+static int test_block_policy_change(void)
+{
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 1;
+    attr.queue_size = RING;
+    attr.overflow_policy = THREAD_POOL_OVERFLOW_BLOCK;
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
+    if (pool == NULL)
+        return 1;
+
+    atomic_store(&g_gate_open, 0);
+    atomic_store(&g_gate_running, 0);
+    thread_pool_add(pool, gate_task, NULL);
+    while (!atomic_load(&g_gate_running))
+        usleep(1000);
+    for (int i = 0; i < RING; i++)
+        thread_pool_add(pool, user_task, NULL);
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, blocked_producer, pool);
+    thread_pool_overflow_stats_t stats;
+    do
+    {
+        usleep(1000);
+        thread_pool_get_overflow_stats(pool, &stats);
+    } while (stats.blocked == 0);
+
+    thread_pool_set_overflow_policy(pool, THREAD_POOL_OVERFLOW_REJECT, NULL);
+    void *rc;
+    pthread_join(producer, &rc); // Hangs (alarm) if the producer keeps waiting
+
+    atomic_store(&g_gate_open, 1);
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+
+    if ((long)rc != -2)
+    {
+        fprintf(stderr, "block: producer returned %ld after the switch to REJECT (want -2)\n", (long)rc);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    alarm(20); // A dropped wrapper or a stuck producer shows up as a hang: fail instead
+
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 1;
+    attr.queue_size = RING;
+    attr.overflow_policy = THREAD_POOL_OVERFLOW_DROP_OLDEST;
+    attr.overflow_discard = discard;
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
+    if (pool == NULL)
+        return 1;
+
+    /* 1. Hold the worker */
+    thread_pool_add(pool, gate_task, NULL);
+    while (!atomic_load(&g_gate_running))
+        usleep(1000);
+
+    /* 2. Fill the ring: plain tasks first (the oldest), then one strand runner per key, then group tasks */
+    int failed = 0;
+    thread_pool_add(pool, user_task, NULL);
+    thread_pool_add(pool, user_task, NULL);
+    for (int t = 0; t < TASKS_PER_KEY; t++)
+        for (unsigned long k = 0; k < KEYS; k++)
+            failed |= thread_pool_add_keyed(pool, k, keyed_task, NULL) != 0;
+
+    thread_pool_group_t group;
+    thread_pool_group_init(&group, pool);
+    int grouped = 0;
+    for (int i = 0; i < 2 * RING; i++)
+        grouped += thread_pool_group_add(&group, group_task, NULL) == 0;
+
+    /* 3. Ring full of internal tasks only: nothing left to drop */
+    int user_rc = thread_pool_add(pool, user_task, NULL);
+    thread_pool_overflow_stats_t stats;
+    thread_pool_get_overflow_stats(pool, &stats);
+
+    atomic_store(&g_gate_open, 1);
+    thread_pool_group_wait(&group);
+    thread_pool_wait(pool);
+
+    if (failed || user_rc != -2 || grouped != RING - KEYS)
+    {
+        fprintf(stderr, "submit: keyed failed %d, add on internal-only ring %d (want -2), %d grouped (want %d)\n",
+                failed, user_rc, grouped, RING - KEYS);
+        failed = 1;
+    }
+    if (atomic_load(&g_bad_discards) != 0 || atomic_load(&g_discarded) != 2 || stats.dropped != 2 ||
+        atomic_load(&g_user_ran) != 0)
+    {
+        fprintf(stderr, "drops: %d internal dropped, %d discarded, %ld dropped, %d plain ran\n",
+                atomic_load(&g_bad_discards), atomic_load(&g_discarded), stats.dropped, atomic_load(&g_user_ran));
+        failed = 1;
+    }
+    if (atomic_load(&g_keyed_ran) != KEYS * TASKS_PER_KEY || atomic_load(&g_group_ran) != grouped)
+    {
+        fprintf(stderr, "ran: %d of %d keyed, %d of %d grouped\n", atomic_load(&g_keyed_ran), KEYS * TASKS_PER_KEY,
+                atomic_load(&g_group_ran), grouped);
+        failed = 1;
+    }
+
+    thread_pool_destroy(pool);
+
+    failed |= test_block_policy_change();
+    fprintf(stderr, "test_overflow: %s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
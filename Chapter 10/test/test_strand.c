@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "thread_pool.h"
+
+/* Test: thread_pool_add_keyed with far more keys than table buckets
+ * 1. 5000 distinct keys on 16 buckets: every add succeeds, every task runs
+ * 2. 64 keys x 200 tasks: each key sees its tasks in submission order, never two at a time
+ * 3. One bucket for every key: a blocked key does not stall another key (no head-of-line blocking)
+ * 4. Full ring: add_keyed returns at once and its tasks never run on the producer
+ */
+#define STRANDS 16
+#define DISTINCT_KEYS 5000
+#define ORDER_KEYS 64
+#define TASKS_PER_KEY 200
+
+typedef struct
+{
+    atomic_int running; // Tasks of this key executing now
+    int next;           // Sequence number expected next (only touched by the key's strand)
+    atomic_int errors;
+} key_state_t;
+
+typedef struct
+{
+    key_state_t *key;
+    int seq;
+} order_arg_t;
+
+static atomic_long g_ran;
+static key_state_t g_keys[ORDER_KEYS];
+static order_arg_t g_args[ORDER_KEYS][TASKS_PER_KEY];
+
+static void count_task(void *arg)
+{
+    (void)arg;
+    atomic_fetch_add(&g_ran, 1);
+}
+
+static void order_task(void *arg)
+{
+    order_arg_t *a = arg;
+    if (atomic_fetch_add(&(a->key->running), 1) != 0)
+        atomic_fetch_add(&(a->key->errors), 1); // Two tasks of one key at the same time
+    if (a->key->next != a->seq)
+        atomic_fetch_add(&(a->key->errors), 1); // Out of order
+    a->key->next = a->seq + 1;
+    atomic_fetch_sub(&(a->key->running), 1);
+}
+
+/* 3. The task of key 0 waits for the task of key 1: serialized keys would never let it run */
+static atomic_int g_other_ran;
+
+static void wait_other_task(void *arg)
+{
+    atomic_int *stalled = arg;
+    for (int i = 0; i < 2000 && !atomic_load(&g_other_ran); i++)
+        usleep(1000);
+    if (!atomic_load(&g_other_ran))
+        atomic_store(stalled, 1);
+}
+
+static void other_task(void *arg)
+{
+    (void)arg;
+    atomic_store(&g_other_ran, 1);
+}
+
+/* 4. Gate holds the only worker while the ring fills: a task run before the gate opens ran on the producer */
+static atomic_int g_gate_open, g_gate_running;
+
+static void gate_task(void *arg)
+{
+    (void)arg;
+    atomic_store(&g_gate_running, 1);
+    while (!atomic_load(&g_gate_open))
+        usleep(1000);
+}
+
+static int test_isolation(void)
+{
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 2;
+    attr.strand_capacity = 1;
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
+    if (pool == NULL)
+        return 1;
+
+    atomic_int stalled = 0;
+    thread_pool_add_keyed(pool, 0, wait_other_task, &stalled);
+    thread_pool_add_keyed(pool, 1, other_task, NULL);
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+    if (atomic_load(&stalled))
+    {
+        fprintf(stderr, "isolation: key 1 waited behind key 0\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int test_full_ring(void)
+{
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 1;
+    attr.queue_size = 4;
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
+    if (pool == NULL)
+        return 1;
+
+    atomic_store(&g_ran, 0);
+    thread_pool_add(pool, gate_task, NULL);
+    while (!atomic_load(&g_gate_running))
+        usleep(1000);
+
+    int add_errors = 0;
+    for (unsigned long k = 0; k < 32; k++)
+        add_errors += thread_pool_add_keyed(pool, k, count_task, NULL) != 0;
+    long ran_early = atomic_load(&g_ran); // Worker still held: anything that ran, ran on the producer
+
+    atomic_store(&g_gate_open, 1);
+    thread_pool_wait(pool);
+    thread_pool_destroy(pool);
+    if (add_errors != 0 || ran_early != 0 || atomic_load(&g_ran) != 32)
+    {
+        fprintf(stderr, "full ring: %d adds failed, %ld ran on the producer, %ld of 32 ran\n", add_errors, ran_early,
+                atomic_load(&g_ran));
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    alarm(30); // Keys stuck behind each other show up as a hang: fail instead
+
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 4;
+    attr.queue_size = 256;
+    attr.strand_capacity = STRANDS;
+    thread_pool_t *pool = thread_pool_create_attr(&attr);
+    if (pool == NULL)
+        return 1;
+
+    int failed = 0;
+
+    /* 1. More keys than strands: no add may fail */
+    int add_errors = 0;
+    for (unsigned long k = 0; k < DISTINCT_KEYS; k++)
+        add_errors += thread_pool_add_keyed(pool, k * 7919, count_task, NULL) != 0;
+    thread_pool_wait(pool);
+    if (add_errors != 0 || atomic_load(&g_ran) != DISTINCT_KEYS)
+    {
+        fprintf(stderr, "distinct keys: %d adds failed, %ld of %d tasks ran\n", add_errors, atomic_load(&g_ran),
+                DISTINCT_KEYS);
+        failed = 1;
+    }
+
+    /* 2. Order per key, keys interleaved (several keys share each strand) */
+    for (int s = 0; s < TASKS_PER_KEY; s++)
+    {
+        for (int k = 0; k < ORDER_KEYS; k++)
+        {
+            g_args[k][s].key = &g_keys[k];
+            g_args[k][s].seq = s;
+            if (thread_pool_add_keyed(pool, (unsigned long)k, order_task, &g_args[k][s]) != 0)
+                atomic_fetch_add(&(g_keys[k].errors), 1);
+        }
+    }
+    thread_pool_wait(pool);
+    for (int k = 0; k < ORDER_KEYS; k++)
+    {
+        if (atomic_load(&(g_keys[k].errors)) != 0 || g_keys[k].next != TASKS_PER_KEY)
+        {
+            fprintf(stderr, "key %d: %d errors, %d of %d tasks in order\n", k, atomic_load(&(g_keys[k].errors)),
+                    g_keys[k].next, TASKS_PER_KEY);
+            failed = 1;
+        }
+    }
+
+    thread_pool_destroy(pool);
+
+    failed |= test_isolation();
+    failed |= test_full_ring();
+    fprintf(stderr, "test_strand: %s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}
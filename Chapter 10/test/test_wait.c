@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include "thread_pool.h"
+
+/* Test: thread_pool_wait from outside the pool while a task waits inside it
+ * Main waits while task T runs a nested thread_pool_wait on task U. U finishes first: the nested wait
+ * returns, but main must keep waiting until T itself has returned
+ */
+static thread_pool_t *g_pool;
+static atomic_int g_u_done, g_t_done;
+
+static void task_u(void *arg)
+{
+    (void)arg;
+    usleep(50 * 1000);
+    atomic_store(&g_u_done, 1);
+}
+
+static void task_t(void *arg)
+{
+    (void)arg;
+    thread_pool_add(g_pool, task_u, NULL);
+    thread_pool_wait(g_pool); // Nested: does not wait for T itself
+    usleep(100 * 1000);       // Still outstanding after U is done
+    atomic_store(&g_t_done, 1);
+}
+
+int main(void)
+{
+    alarm(20); // A nested wait that waits for itself shows up as a hang: fail instead
+
+    thread_pool_attr_t attr;
+    thread_pool_attr_init(&attr);
+    attr.thread_count = 2;
+    g_pool = thread_pool_create_attr(&attr);
+    if (g_pool == NULL)
+        return 1;
+
+    int failed = 0;
+    for (int round = 0; round < 5 && !failed; round++)
+    {
+        atomic_store(&g_u_done, 0);
+        atomic_store(&g_t_done, 0);
+        thread_pool_add(g_pool, task_t, NULL);
+        thread_pool_wait(g_pool);
+        if (!atomic_load(&g_u_done) || !atomic_load(&g_t_done))
+        {
+            fprintf(stderr, "round %d: wait returned with U done %d, T done %d\n", round, atomic_load(&g_u_done),
+                    atomic_load(&g_t_done));
+            failed = 1;
+        }
+    }
+
+    thread_pool_destroy(g_pool);
+    fprintf(stderr, "test_wait: %s\n", failed ? "FAIL" : "PASS");
+    return failed;
+}